@@ -0,0 +1,235 @@
+/***************************************************
+ Filename: backlight.c
+
+***************************************************/
+
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <wiringPi.h>
+#include <softPwm.h>
+#include "gpio.h"
+#include "keyqueue.h"
+#include "backlight.h"
+
+#define IDLE_ACTIVE     0
+#define IDLE_DIMMED     1
+#define IDLE_OFF        2
+
+static int driver = BACKLIGHT_NONE;
+static int timerFd = -1;
+static int isSoftPwmRunning = 0;
+static int lastDuty = -1;
+
+static int current = 0;     // Perceived level now
+static int userLevel = 0;   // What the brightness keys asked for
+static int fadeFrom, fadeTo;
+static uint64_t fadeStart, fadeLength; // Nanoseconds; fadeLength 0 when not fading
+
+static int idlePhase = IDLE_ACTIVE;
+static uint64_t lastActivity;
+static uint64_t dimAfter, offAfter; // Nanoseconds, 0 to never
+static int idleDimLevel;
+
+// Perceived level to PWM duty out of range
+static int gammaDuty(int level, int range)
+{
+    return (int) lround(pow((double) level / BACKLIGHT_MAX, BACKLIGHT_GAMMA) * range);
+}
+
+static void writeLevel(int level)
+{
+    int range = (driver == BACKLIGHT_HARDWARE) ? BACKLIGHT_RANGE : BACKLIGHT_SOFT_RANGE;
+    int duty = gammaDuty(level, range);
+
+    current = level;
+    if (duty == lastDuty) {
+        return;
+    }
+    lastDuty = duty;
+
+    if (driver == BACKLIGHT_HARDWARE) {
+        pwmWrite(BACKLIGHT_PIN, duty);
+    } else if (driver == BACKLIGHT_SOFTWARE) {
+        // Only partway levels need the software PWM thread
+        if (duty > 0 && duty < range) {
+            if (!isSoftPwmRunning) {
+                softPwmCreate(BACKLIGHT_PIN, duty, range);
+                isSoftPwmRunning = 1;
+            }
+            softPwmWrite(BACKLIGHT_PIN, duty);
+        } else {
+            if (isSoftPwmRunning) {
+                softPwmStop(BACKLIGHT_PIN);
+                isSoftPwmRunning = 0;
+            }
+            pinMode(BACKLIGHT_PIN, OUTPUT);
+            digitalWrite(BACKLIGHT_PIN, duty ? HIGH : LOW);
+        }
+    }
+}
+
+static void armTimer(uint64_t nanoseconds)
+{
+    struct itimerspec timer = {{0, 0}, {0, 0}};
+
+    if (nanoseconds == 0) {
+        nanoseconds = 1; // Zero would disarm
+    }
+    timer.it_value.tv_sec = nanoseconds / 1000000000ull;
+    timer.it_value.tv_nsec = nanoseconds % 1000000000ull;
+    timerfd_settime(timerFd, 0, &timer, NULL);
+}
+
+// The timer runs every frame while fading, otherwise until the next idle step
+static void schedule(uint64_t now)
+{
+    struct itimerspec disarm = {{0, 0}, {0, 0}};
+    uint64_t due = 0;
+
+    if (timerFd == -1) {
+        return;
+    }
+    if (fadeLength) {
+        armTimer(BACKLIGHT_FRAME * 1000000ull);
+        return;
+    }
+
+    if (idlePhase == IDLE_ACTIVE && dimAfter) {
+        due = lastActivity + dimAfter;
+    } else if (idlePhase != IDLE_OFF && offAfter) {
+        due = lastActivity + offAfter;
+    }
+    if (due == 0) {
+        timerfd_settime(timerFd, 0, &disarm, NULL);
+        return;
+    }
+    armTimer(due > now ? due - now : 0);
+}
+
+static void startFade(int level, int fadeMillis, uint64_t now)
+{
+    if (timerFd == -1 || fadeMillis <= 0) {
+        fadeLength = 0;
+        writeLevel(level);
+        return;
+    }
+    fadeFrom = current;
+    fadeTo = level;
+    fadeStart = now;
+    fadeLength = fadeMillis * 1000000ull;
+}
+
+// Returns the driver in use
+int backlightInit(int hasPin, int level)
+{
+    driver = BACKLIGHT_NONE;
+    if (hasPin) {
+        // Only the PWM0/PWM1 pins have the hardware behind them
+        switch (wpiPinToGpio(BACKLIGHT_PIN)) {
+        case 12: case 13: case 18: case 19:
+            driver = BACKLIGHT_HARDWARE;
+            pinMode(BACKLIGHT_PIN, PWM_OUTPUT);
+            pwmSetMode(PWM_MODE_MS);
+            pwmSetRange(BACKLIGHT_RANGE);
+            pwmSetClock(2); // 19.2MHz / 2 / 1024, about 9.4kHz and well past flicker
+            break;
+        default:
+            driver = BACKLIGHT_SOFTWARE;
+        }
+    }
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    userLevel = level;
+    lastActivity = monotonicNanos();
+    writeLevel(level);
+
+    return driver;
+}
+
+int backlightFd(void)
+{
+    return timerFd;
+}
+
+void backlightSet(int level, int fadeMillis)
+{
+    uint64_t now = monotonicNanos();
+
+    userLevel = level;
+    lastActivity = now;
+    idlePhase = IDLE_ACTIVE;
+    startFade(level, fadeMillis, now);
+    schedule(now);
+}
+
+// Dim to dimLevel after dimMillis without a key, and turn off after offMillis
+void backlightSetIdle(int dimMillis, int offMillis, int dimLevel)
+{
+    dimAfter = dimMillis * 1000000ull;
+    offAfter = offMillis * 1000000ull;
+    idleDimLevel = dimLevel;
+    schedule(monotonicNanos());
+}
+
+// Called on every key press. Only wakes the backlight, so it costs no
+// system call while the backlight is already up; the idle timer notices
+// the new activity when it next fires.
+void backlightActivity(void)
+{
+    uint64_t now = monotonicNanos();
+
+    lastActivity = now;
+    if (idlePhase != IDLE_ACTIVE) {
+        idlePhase = IDLE_ACTIVE;
+        startFade(userLevel, BACKLIGHT_FADE, now);
+        schedule(now);
+    }
+}
+
+void backlightExpired(void)
+{
+    uint64_t expirations;
+    uint64_t now, elapsed;
+
+    if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    now = monotonicNanos();
+
+    if (fadeLength) {
+        elapsed = now - fadeStart;
+        if (elapsed >= fadeLength) {
+            fadeLength = 0;
+            writeLevel(fadeTo);
+        } else {
+            writeLevel(fadeFrom + (int) ((int64_t) (fadeTo - fadeFrom) * (int64_t) elapsed / (int64_t) fadeLength));
+        }
+    }
+
+    if (idlePhase != IDLE_OFF && offAfter && now - lastActivity >= offAfter) {
+        idlePhase = IDLE_OFF;
+        startFade(0, BACKLIGHT_IDLE_FADE, now);
+    } else if (idlePhase == IDLE_ACTIVE && dimAfter && now - lastActivity >= dimAfter) {
+        idlePhase = IDLE_DIMMED;
+        startFade(idleDimLevel < userLevel ? idleDimLevel : userLevel, BACKLIGHT_IDLE_FADE, now);
+    }
+
+    schedule(now);
+}
+
+// Fades to black before returning, for the shutdown path
+void backlightFadeOut(int fadeMillis)
+{
+    struct timespec frame = {0, BACKLIGHT_FRAME * 1000000L};
+    int from = current;
+    int frames = fadeMillis / BACKLIGHT_FRAME;
+    int i;
+
+    for (i = 1; i < frames; i++) {
+        writeLevel(from - from * i / frames);
+        nanosleep(&frame, NULL);
+    }
+    writeLevel(0);
+}
@@ -0,0 +1,38 @@
+/***************************************************
+ Filename: backlight.h
+
+ Backlight brightness with gamma correction, fades
+ and idle dimming. Levels are perceived brightness
+ from 0 to BACKLIGHT_MAX. The hardware PWM drives
+ the pin when it can; otherwise wiringPi's software
+ PWM runs, but only while the level is partway, as a
+ fully on or off backlight is a plain output. Fades
+ and idle timeouts run off a timerfd that the owner
+ watches, calling backlightExpired() when readable.
+ ***************************************************/
+
+#ifndef backlight_h
+#define backlight_h
+
+#define BACKLIGHT_MAX           1000
+#define BACKLIGHT_GAMMA         2.2
+#define BACKLIGHT_RANGE         1024 // Hardware PWM steps
+#define BACKLIGHT_SOFT_RANGE    100  // Software PWM steps, of 100us each
+#define BACKLIGHT_FRAME         16   // Milliseconds between fade steps
+#define BACKLIGHT_FADE          250  // Milliseconds for an ordinary fade
+#define BACKLIGHT_IDLE_FADE     2000 // Milliseconds to fade when dimming for idle
+
+// Drivers
+#define BACKLIGHT_NONE          0 // No backlight pin, levels are only tracked
+#define BACKLIGHT_HARDWARE      1
+#define BACKLIGHT_SOFTWARE      2
+
+int backlightInit(int hasPin, int level);
+int backlightFd(void);
+void backlightSet(int level, int fadeMillis);
+void backlightSetIdle(int dimMillis, int offMillis, int dimLevel);
+void backlightActivity(void);
+void backlightExpired(void);
+void backlightFadeOut(int fadeMillis);
+
+#endif /* backlight_h */
@@ -0,0 +1,83 @@
+/***************************************************
+ Filename: chord.c
+
+***************************************************/
+
+#include <string.h>
+#include "chord.h"
+
+#define PHASE_OPEN      0 // Not all of its keys are down
+#define PHASE_HOLDING   1 // Complete, waiting out the hold time
+#define PHASE_DONE      2 // Fired or missed its window; waits for a release
+
+static int isExactly(const uint8_t *state, const uint8_t *keys)
+{
+    return memcmp(state, keys, DEBOUNCE_ROWS) == 0;
+}
+
+// The earliest press among the chord's keys
+static uint64_t firstDown(const ChordEngine *engine, const uint8_t *keys)
+{
+    uint64_t earliest = UINT64_MAX;
+    uint8_t bits;
+    int row, col;
+
+    for (row = 0; row < DEBOUNCE_ROWS; row++) {
+        for (bits = keys[row]; bits; bits &= bits - 1) {
+            col = __builtin_ctz(bits);
+            if (engine->downSince[row][col] < earliest) {
+                earliest = engine->downSince[row][col];
+            }
+        }
+    }
+    return earliest;
+}
+
+void chordInit(ChordEngine *engine, const Chord *chords, int count)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->chords = chords;
+    engine->count = (count > CHORD_MAX) ? CHORD_MAX : count;
+}
+
+// Call once per scan with the debounced state. Fills fired with the
+// indices of the chords that fired on this scan and returns how many.
+int chordUpdate(ChordEngine *engine, const uint8_t *state, uint64_t now, uint8_t *fired)
+{
+    const Chord *chord;
+    uint8_t pressed;
+    int row, col, i;
+    int count = 0;
+
+    for (row = 0; row < DEBOUNCE_ROWS; row++) {
+        for (pressed = state[row] & ~engine->previous[row]; pressed; pressed &= pressed - 1) {
+            col = __builtin_ctz(pressed);
+            engine->downSince[row][col] = now;
+        }
+        engine->previous[row] = state[row];
+    }
+
+    for (i = 0; i < engine->count; i++) {
+        chord = &engine->chords[i];
+        if (!isExactly(state, chord->keys)) {
+            engine->phase[i] = PHASE_OPEN;
+            continue;
+        }
+
+        if (engine->phase[i] == PHASE_OPEN) {
+            if (chord->window && now - firstDown(engine, chord->keys) > chord->window * 1000000ull) {
+                engine->phase[i] = PHASE_DONE;
+                continue;
+            }
+            engine->phase[i] = PHASE_HOLDING;
+            engine->heldSince[i] = now;
+        }
+
+        if (engine->phase[i] == PHASE_HOLDING && now - engine->heldSince[i] >= chord->hold * 1000000ull) {
+            engine->phase[i] = PHASE_DONE;
+            fired[count++] = i;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,44 @@
+/***************************************************
+ Filename: chord.h
+
+ Chord detection over the debounced key bitmap, ON
+ key included. A chord fires when exactly its keys
+ are held, pressed within its window of each other,
+ and kept down for its hold time. It fires once per
+ press and is evaluated on every scan, so timing is
+ to the scan period and nothing waits.
+ ***************************************************/
+
+#ifndef chord_h
+#define chord_h
+
+#include <stdint.h>
+#include "debounce.h"
+
+#define CHORD_MAX   16
+
+// Actions, carried to the main loop in the row of an EVENT_CHORD
+#define CHORD_MODE_CYCLE    1
+#define CHORD_POWER_DOWN    2
+
+typedef struct {
+    uint8_t keys[DEBOUNCE_ROWS];    // Column bitmask per row, ON key in ONKEY_ROW
+    uint16_t window;                // Milliseconds from the first key down to the last, 0 for any
+    uint16_t hold;                  // Milliseconds held before it fires
+    uint8_t action;
+    uint8_t modes;                  // Bit (1 << mode) per mode it acts in, 0 for all; the main loop checks
+} Chord;
+
+typedef struct {
+    const Chord *chords;
+    int count;
+    uint8_t previous[DEBOUNCE_ROWS];
+    uint64_t downSince[DEBOUNCE_ROWS][8];
+    uint64_t heldSince[CHORD_MAX];
+    uint8_t phase[CHORD_MAX];
+} ChordEngine;
+
+void chordInit(ChordEngine *engine, const Chord *chords, int count);
+int chordUpdate(ChordEngine *engine, const uint8_t *state, uint64_t now, uint8_t *fired);
+
+#endif /* chord_h */
@@ -0,0 +1,72 @@
+/***************************************************
+ Filename: debounce.c
+
+***************************************************/
+
+#include <string.h>
+#include "debounce.h"
+
+void debounceInit(Debouncer *debouncer, int pressTicks, int releaseTicks)
+{
+    memset(debouncer, 0, sizeof(*debouncer));
+    debounceSetTicks(debouncer, pressTicks, releaseTicks);
+}
+
+// Keys part way through keep their counts
+void debounceSetTicks(Debouncer *debouncer, int pressTicks, int releaseTicks)
+{
+    debouncer->pressTicks = (pressTicks < 1) ? 1 : pressTicks;
+    debouncer->releaseTicks = (releaseTicks < 1) ? 1 : releaseTicks;
+}
+
+// Feed one raw sample of every row. changed receives, per row, the keys whose
+// debounced state flipped on this tick; the new state is in debouncer->state.
+void debounceUpdate(Debouncer *debouncer, const uint8_t *sample, uint8_t *changed)
+{
+    int row, col;
+    uint8_t diff, bits, threshold;
+
+    for (row = 0; row < DEBOUNCE_ROWS; row++) {
+        diff = sample[row] ^ debouncer->state[row];
+        changed[row] = 0;
+
+        if (diff == 0 && debouncer->pending[row] == 0) {
+            continue;
+        }
+
+        // Keys that bounced back lose their progress
+        bits = debouncer->pending[row] & ~diff;
+        while (bits) {
+            col = __builtin_ctz(bits);
+            bits &= bits - 1;
+            debouncer->counts[row][col] = 0;
+        }
+
+        bits = diff;
+        while (bits) {
+            col = __builtin_ctz(bits);
+            bits &= bits - 1;
+            threshold = (sample[row] & (1 << col)) ? debouncer->pressTicks : debouncer->releaseTicks;
+            if (++debouncer->counts[row][col] >= threshold) {
+                debouncer->counts[row][col] = 0;
+                changed[row] |= 1 << col;
+            }
+        }
+
+        debouncer->state[row] ^= changed[row];
+        debouncer->pending[row] = diff & ~changed[row];
+    }
+}
+
+// True when no key is down or on its way down
+int debounceIsIdle(const Debouncer *debouncer)
+{
+    int row;
+
+    for (row = 0; row < DEBOUNCE_ROWS; row++) {
+        if (debouncer->state[row] || debouncer->pending[row]) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,37 @@
+/***************************************************
+ Filename: debounce.h
+
+ Per-key debouncing. A key only changes state once
+ the raw samples have disagreed with it for enough
+ consecutive scans, so each key is filtered on its
+ own and nothing ever sleeps.
+ ***************************************************/
+
+#ifndef debounce_h
+#define debounce_h
+
+#include <stdint.h>
+#include "gpio.h"
+
+// How long, in Milliseconds, a key must read steady before it changes.
+// The scanner turns these into ticks at its current rate.
+#define DEBOUNCE_PRESS_TIME     5
+#define DEBOUNCE_RELEASE_TIME   15
+#define DEBOUNCE_MAX_TIME       250 // Counts are 8 bits, at 1 tick a Millisecond on the fastest tier
+
+#define DEBOUNCE_ROWS   (ROW_COUNT + 1) // Includes the ON key row
+
+typedef struct {
+    uint8_t state[DEBOUNCE_ROWS];   // Debounced column bitmask per row
+    uint8_t pending[DEBOUNCE_ROWS]; // Keys whose raw samples currently disagree with state
+    uint8_t counts[DEBOUNCE_ROWS][8];
+    uint8_t pressTicks;
+    uint8_t releaseTicks;
+} Debouncer;
+
+void debounceInit(Debouncer *debouncer, int pressTicks, int releaseTicks);
+void debounceSetTicks(Debouncer *debouncer, int pressTicks, int releaseTicks);
+void debounceUpdate(Debouncer *debouncer, const uint8_t *sample, uint8_t *changed);
+int debounceIsIdle(const Debouncer *debouncer);
+
+#endif /* debounce_h */
@@ -0,0 +1,180 @@
+/***************************************************
+  Filename: debouncetest.c
+
+  Runs noisy press and release waveforms for every
+  key through debounceUpdate() and checks what comes
+  out. Each clean stroke, however it bounces on the
+  way in and out, must give exactly one press and one
+  release, each on the tick its steady run reaches
+  the threshold. Glitches shorter than the press or
+  release time must give nothing.
+
+***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debounce.h"
+
+#define TEST_TICKS      20000
+#define TEST_KEYS       (DEBOUNCE_ROWS * COL_COUNT)
+#define TEST_EVENTS     (TEST_TICKS / 4)
+
+typedef struct {
+    int tick;
+    int pressed;
+} Expected;
+
+typedef struct {
+    uint8_t wave[TEST_TICKS];
+    Expected events[TEST_EVENTS];
+    int eventCount;
+    int next;
+    int strokes;
+    int glitches;
+} KeyTrace;
+
+static KeyTrace traces[TEST_KEYS];
+static unsigned int seed;
+
+static int randomRange(int low, int high)
+{
+    seed = seed * 1103515245 + 12345;
+    return low + (int) ((seed >> 16) % (unsigned int) (high - low + 1));
+}
+
+// Appends a run of level, clipped to the end of the trace. Returns where it ends.
+static int run(KeyTrace *trace, int tick, int length, int level)
+{
+    while (length-- > 0 && tick < TEST_TICKS) {
+        trace->wave[tick++] = level;
+    }
+    return tick;
+}
+
+// Chatter that never holds either level for as long as bounce allows, ending on level
+static int bounce(KeyTrace *trace, int tick, int bounce, int level)
+{
+    int flips = (bounce > 0) ? randomRange(0, 6) : 0;
+
+    while (flips-- > 0) {
+        tick = run(trace, tick, randomRange(1, bounce), level);
+        tick = run(trace, tick, randomRange(1, bounce), !level);
+    }
+    return tick;
+}
+
+// Short runs of !level inside a steady stretch of level, each shorter than glitch
+static int steady(KeyTrace *trace, int tick, int length, int glitch)
+{
+    int level = trace->wave[tick - 1];
+    int end = tick + length;
+
+    while (tick < end) {
+        tick = run(trace, tick, randomRange(1, 12), level);
+        if (glitch > 0 && tick < end && randomRange(0, 3) == 0) {
+            tick = run(trace, tick, randomRange(1, glitch), !level);
+            tick = run(trace, tick, 1, level);
+            trace->glitches++;
+        }
+    }
+    return tick;
+}
+
+static void expect(KeyTrace *trace, int tick, int pressed)
+{
+    if (tick < TEST_TICKS && trace->eventCount < TEST_EVENTS) {
+        trace->events[trace->eventCount++] = (Expected) { tick, pressed };
+    }
+}
+
+// Idle, a bouncing press, a hold with dropouts, a bouncing release, and again
+static void generate(KeyTrace *trace, int pressTicks, int releaseTicks)
+{
+    int shortest = (pressTicks < releaseTicks) ? pressTicks : releaseTicks;
+    int tick = run(trace, 0, releaseTicks, 0);
+
+    // Room for the longest stroke, so none is cut off
+    while (tick < TEST_TICKS - 400) {
+        tick = steady(trace, tick, randomRange(0, 60), pressTicks - 1);
+
+        // The bounce ends released, so the steady press starts on a known tick
+        tick = bounce(trace, tick, shortest - 1, 1);
+        tick = run(trace, tick, pressTicks, 1);
+        expect(trace, tick - 1, 1);
+        tick = steady(trace, tick, randomRange(0, 60), releaseTicks - 1);
+
+        tick = bounce(trace, tick, shortest - 1, 0);
+        tick = run(trace, tick, releaseTicks, 0);
+        expect(trace, tick - 1, 0);
+        trace->strokes++;
+    }
+}
+
+static int runTraces(int pressTicks, int releaseTicks)
+{
+    Debouncer debouncer;
+    uint8_t sample[DEBOUNCE_ROWS];
+    uint8_t changed[DEBOUNCE_ROWS];
+    KeyTrace *trace;
+    int tick, key, failures = 0, strokes = 0, glitches = 0;
+
+    memset(traces, 0, sizeof(traces));
+    for (key = 0; key < TEST_KEYS; key++) {
+        generate(&traces[key], pressTicks, releaseTicks);
+        strokes += traces[key].strokes;
+        glitches += traces[key].glitches;
+    }
+
+    debounceInit(&debouncer, pressTicks, releaseTicks);
+    for (tick = 0; tick < TEST_TICKS; tick++) {
+        memset(sample, 0, sizeof(sample));
+        for (key = 0; key < TEST_KEYS; key++) {
+            sample[key / COL_COUNT] |= traces[key].wave[tick] << (key % COL_COUNT);
+        }
+        debounceUpdate(&debouncer, sample, changed);
+
+        for (key = 0; key < TEST_KEYS; key++) {
+            if (!(changed[key / COL_COUNT] & (1 << (key % COL_COUNT)))) {
+                continue;
+            }
+            trace = &traces[key];
+            if (trace->next == trace->eventCount || trace->events[trace->next].tick != tick ||
+                trace->events[trace->next].pressed != ((debouncer.state[key / COL_COUNT] >> (key % COL_COUNT)) & 1)) {
+                if (failures++ < 10) {
+                    printf("  key %d,%d: unexpected %s at tick %d\n", key / COL_COUNT, key % COL_COUNT,
+                           ((debouncer.state[key / COL_COUNT] >> (key % COL_COUNT)) & 1) ? "press" : "release", tick);
+                }
+                continue;
+            }
+            trace->next++;
+        }
+    }
+
+    for (key = 0; key < TEST_KEYS; key++) {
+        trace = &traces[key];
+        if (trace->next != trace->eventCount) {
+            if (failures++ < 10) {
+                printf("  key %d,%d: missing %s due at tick %d\n", key / COL_COUNT, key % COL_COUNT,
+                       trace->events[trace->next].pressed ? "press" : "release", trace->events[trace->next].tick);
+            }
+        }
+    }
+
+    printf("%2d/%-2d ticks: %6d strokes, %6d glitches, %s\n", pressTicks, releaseTicks, strokes, glitches,
+           failures ? "FAILED" : "ok");
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    int failures = 0;
+
+    seed = (argc > 1) ? atoi(argv[1]) : 83;
+    failures += runTraces(1, 1);
+    failures += runTraces(DEBOUNCE_PRESS_TIME, DEBOUNCE_RELEASE_TIME);
+    failures += runTraces(3, 8);
+    failures += runTraces(12, 4);
+
+    return failures ? 1 : 0;
+}
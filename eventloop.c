@@ -0,0 +1,153 @@
+/***************************************************
+ Filename: eventloop.c
+
+***************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#ifndef HEADLESS
+#include <gtk/gtk.h>
+#endif
+#include "eventloop.h"
+
+typedef struct {
+    int fd;
+    LoopHandler handler; // NULL when the slot is free
+    void *data;
+    unsigned int source; // GLib source id
+} Watch;
+
+static Watch watches[LOOP_WATCHES];
+
+static int findSlot(void)
+{
+    int i;
+
+    for (i = 0; i < LOOP_WATCHES; i++) {
+        if (watches[i].handler == NULL) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifdef HEADLESS
+
+static int epollFd = -1;
+static int running;
+
+int loopWatch(int fd, LoopHandler handler, void *data)
+{
+    struct epoll_event event;
+    int id;
+
+    if (epollFd == -1 && (epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        return -1;
+    }
+    if ((id = findSlot()) == -1) {
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = &watches[id];
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        return -1;
+    }
+    watches[id] = (Watch) { fd, handler, data, 0 };
+    return id;
+}
+
+void loopUnwatch(int id)
+{
+    if (id >= 0 && watches[id].handler != NULL) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, watches[id].fd, NULL);
+        watches[id].handler = NULL;
+    }
+}
+
+void loopRun(void)
+{
+    struct epoll_event events[LOOP_WATCHES];
+    Watch *watch;
+    int count, i;
+
+    running = 1;
+    while (running) {
+        if ((count = epoll_wait(epollFd, events, LOOP_WATCHES, -1)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (i = 0; i < count && running; i++) {
+            watch = events[i].data.ptr;
+            // An earlier handler in this batch may have removed it
+            if (watch->handler != NULL) {
+                watch->handler(watch->fd, watch->data);
+            }
+        }
+    }
+}
+
+void loopQuit(void)
+{
+    running = 0;
+}
+
+#else
+
+static gboolean dispatch(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    Watch *watch = data;
+
+    watch->handler(watch->fd, watch->data);
+    return TRUE;
+}
+
+int loopWatch(int fd, LoopHandler handler, void *data)
+{
+    GIOChannel *channel;
+    int id;
+
+    if ((id = findSlot()) == -1) {
+        return -1;
+    }
+
+    watches[id] = (Watch) { fd, handler, data, 0 };
+    channel = g_io_channel_unix_new(fd);
+    watches[id].source = g_io_add_watch(channel, G_IO_IN, dispatch, &watches[id]);
+    g_io_channel_unref(channel); // The watch holds its own reference
+    return id;
+}
+
+void loopUnwatch(int id)
+{
+    if (id >= 0 && watches[id].handler != NULL) {
+        g_source_remove(watches[id].source);
+        watches[id].handler = NULL;
+    }
+}
+
+void loopRun(void)
+{
+    gtk_main();
+}
+
+void loopQuit(void)
+{
+    gtk_main_quit();
+}
+
+#endif
+
+void loopUnwatchFd(int fd)
+{
+    int i;
+
+    for (i = 0; i < LOOP_WATCHES; i++) {
+        if (watches[i].handler != NULL && watches[i].fd == fd) {
+            loopUnwatch(i);
+        }
+    }
+}
@@ -0,0 +1,23 @@
+/***************************************************
+ Filename: eventloop.h
+
+ The driver's main loop: handlers run on the main
+ thread whenever their file descriptor is readable.
+ It is the GTK main loop in the tray build, and a
+ plain epoll loop in the headless (HEADLESS) build.
+ ***************************************************/
+
+#ifndef eventloop_h
+#define eventloop_h
+
+#define LOOP_WATCHES    24
+
+typedef void (*LoopHandler)(int fd, void *data);
+
+int loopWatch(int fd, LoopHandler handler, void *data); // Returns an id for loopUnwatch, or -1
+void loopUnwatch(int id);
+void loopUnwatchFd(int fd);
+void loopRun(void);
+void loopQuit(void);
+
+#endif /* eventloop_h */
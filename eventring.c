@@ -0,0 +1,146 @@
+/***************************************************
+ Filename: eventring.c
+
+***************************************************/
+
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "eventring.h"
+
+// Stays valid even if shared memory is unavailable, so the driver never needs to check
+static EventRing localRing;
+static EventRing *ring = &localRing;
+
+// Tells readers still mapping a ring from an earlier run, which may have crashed, that it is gone
+static void retireRing(void)
+{
+    struct stat status;
+    EventRing *old;
+    int fd;
+
+    if ((fd = shm_open(EVENT_RING_NAME, O_RDWR | O_CLOEXEC, 0)) == -1) {
+        return;
+    }
+    // Only a ring the driver made; another user's object is just unlinked
+    if (fstat(fd, &status) == 0 && status.st_uid == geteuid() && status.st_size == sizeof(EventRing)) {
+        old = mmap(NULL, sizeof(EventRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED) {
+            old->magic = 0;
+            syscall(SYS_futex, &old->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+            munmap(old, sizeof(EventRing));
+        }
+    }
+    close(fd);
+}
+
+int eventRingOpen(void)
+{
+    struct group *readers = getgrnam(EVENT_RING_GROUP);
+    void *map;
+    int fd;
+
+    // Always a fresh ring of our own, never one left behind or created first by someone else
+    retireRing();
+    shm_unlink(EVENT_RING_NAME);
+    if ((fd = shm_open(EVENT_RING_NAME, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, EVENT_RING_MODE)) == -1) {
+        return -1;
+    }
+    // Readable by root and EVENT_RING_GROUP only, whatever the umask
+    if ((readers != NULL && fchown(fd, -1, readers->gr_gid) == -1) ||
+        fchmod(fd, EVENT_RING_MODE) == -1 ||
+        ftruncate(fd, sizeof(EventRing)) == -1) {
+        close(fd);
+        shm_unlink(EVENT_RING_NAME);
+        return -1;
+    }
+    map = mmap(NULL, sizeof(EventRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        shm_unlink(EVENT_RING_NAME);
+        return -1;
+    }
+
+    // ftruncate() zeroed it, so only the header needs filling in
+    ring = map;
+    ring->version = EVENT_RING_VERSION;
+    ring->size = EVENT_RING_SIZE;
+    atomic_thread_fence(memory_order_release);
+    ring->magic = EVENT_RING_MAGIC;
+    return 0;
+}
+
+void eventRingClose(void)
+{
+    if (ring != &localRing) {
+        ring->magic = 0;
+        eventRingWake();
+        munmap(ring, sizeof(EventRing));
+        ring = &localRing;
+        shm_unlink(EVENT_RING_NAME);
+    }
+}
+
+// Single writer: only the main loop publishes
+void eventRingPublish(const RingEvent *event)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    RingEvent *slot = &ring->events[head & (EVENT_RING_SIZE - 1)];
+
+    atomic_store_explicit(&slot->sequence, head * 2 + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->keysym = event->keysym;
+    slot->timestamp = event->timestamp;
+    slot->detected = event->detected;
+    slot->type = event->type;
+    slot->row = event->row;
+    slot->col = event->col;
+    slot->mode = event->mode;
+    slot->keypad = event->keypad;
+    atomic_store_explicit(&slot->sequence, head * 2 + 2, memory_order_release);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// One wake for a whole batch of published events
+void eventRingWake(void)
+{
+    if (ring != &localRing) {
+        syscall(SYS_futex, &ring->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Maps the running driver's ring read only, or returns NULL
+const EventRing *eventRingAttach(void)
+{
+    int fd;
+    EventRing *map;
+
+    if ((fd = shm_open(EVENT_RING_NAME, O_RDONLY | O_CLOEXEC, 0)) == -1) {
+        return NULL;
+    }
+    map = mmap(NULL, sizeof(EventRing), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    if (map->magic != EVENT_RING_MAGIC || map->version != EVENT_RING_VERSION || map->size != EVENT_RING_SIZE) {
+        munmap(map, sizeof(EventRing));
+        return NULL;
+    }
+    return map;
+}
+
+// Sleeps until the head moves past position, the timeout (NULL for none)
+// passes or a signal arrives. Returns immediately if it already has.
+int eventRingWait(const EventRing *ring, uint32_t position, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, &ring->head, FUTEX_WAIT, position, timeout, NULL, 0);
+}
@@ -0,0 +1,113 @@
+/***************************************************
+ Filename: eventring.h
+
+ Key event stream for other local processes. The
+ driver publishes every decoded event, with the mode
+ and keysym it resolved to, into a ring in POSIX
+ shared memory. Any number of readers map it read
+ only and follow it at their own pace; a reader that
+ falls a whole ring behind skips ahead and is told
+ how many events it missed.
+
+ Each slot is a seqlock: its sequence is odd while
+ the slot is being written. Readers sleep on a futex
+ on the ring head, which the driver wakes once per
+ batch of events. The mode socket (notify.h) greets
+ each client with the ring to attach to:
+
+     events <shm name> <version> <size>\n
+
+ The ring carries every keystroke, so it is readable
+ only by root and by members of EVENT_RING_GROUP;
+ without that group, only root can read it.
+ ***************************************************/
+
+#ifndef eventring_h
+#define eventring_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define EVENT_RING_NAME     "/ti83keypad-events"
+#define EVENT_RING_MAGIC    0x54493845 // "TI8E"
+#define EVENT_RING_VERSION  2
+#define EVENT_RING_SIZE     1024 // Must be a power of two
+#define EVENT_RING_GROUP    "ti83keypad" // Readers must be in it
+#define EVENT_RING_MODE     0640
+
+typedef struct {
+    atomic_uint sequence; // 2n+1 while event n is being written, 2n+2 once it is complete
+    uint32_t keysym;      // In the mode below; 0 (NoSymbol) for none and for chords
+    uint64_t timestamp;   // CLOCK_MONOTONIC, in nanoseconds, when the event was accepted
+    uint64_t detected;    // When the raw contact change was first seen
+    uint8_t type;         // EVENT_* from keyqueue.h
+    uint8_t row;          // Or the CHORD_* action
+    uint8_t col;          // Or the chord's index in the driver's table
+    uint8_t mode;         // MODE_* the key was pressed in
+    uint8_t keypad;       // Which keypad, from 0
+    uint8_t reserved[3];
+} RingEvent;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t reserved;
+    _Alignas(64) atomic_uint head; // Events published so far, and the futex readers wait on
+    _Alignas(64) RingEvent events[EVENT_RING_SIZE];
+} EventRing;
+
+// Driver side
+int eventRingOpen(void);
+void eventRingClose(void);
+void eventRingPublish(const RingEvent *event);
+void eventRingWake(void);
+
+// Reader side
+const EventRing *eventRingAttach(void);
+int eventRingWait(const EventRing *ring, uint32_t position, const struct timespec *timeout);
+
+// Copies the event at *position into event and advances. Returns 0 once the
+// reader has caught up. Events overwritten before they could be read are
+// skipped and added to *lost.
+static inline int eventRingRead(const EventRing *ring, uint32_t *position, RingEvent *event, uint32_t *lost)
+{
+    const RingEvent *slot;
+    uint32_t head, before, after;
+
+    for (;;) {
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head == *position) {
+            return 0;
+        }
+        if (head - *position > EVENT_RING_SIZE) {
+            *lost += head - *position - EVENT_RING_SIZE;
+            *position = head - EVENT_RING_SIZE;
+        }
+
+        slot = &ring->events[*position & (EVENT_RING_SIZE - 1)];
+        before = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        event->keysym = slot->keysym;
+        event->timestamp = slot->timestamp;
+        event->detected = slot->detected;
+        event->type = slot->type;
+        event->row = slot->row;
+        event->col = slot->col;
+        event->mode = slot->mode;
+        event->keypad = slot->keypad;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+
+        if (before == after && before == *position * 2 + 2) {
+            atomic_store_explicit(&event->sequence, before, memory_order_relaxed);
+            (*position)++;
+            return 1;
+        }
+        // The writer has already reused the slot
+        (*lost)++;
+        (*position)++;
+    }
+}
+
+#endif /* eventring_h */
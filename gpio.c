@@ -0,0 +1,475 @@
+/***************************************************
+ Filename: gpio.c
+
+***************************************************/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <wiringPi.h>
+#include "gpio.h"
+
+// BCM GPIO register word offsets
+#define GPIO_SET0   7
+#define GPIO_CLR0   10
+#define GPIO_LEV0   13
+
+#ifndef GPIO_MEM_DEVICE
+#define GPIO_MEM_DEVICE "/dev/gpiomem"
+#endif
+
+// 74HC595 timing. Each register read is a bus round trip of 50 ns or more, which also
+// makes the write before it land, so two cover its ~25 ns setup time and pulse widths.
+#define SHIFT_HOLD_READS    2
+#define SR_DELAY_US         1 // The same per edge as wiringPi's sr595 on the digitalWrite path
+#define ROW_SETTLE_US       2 // Lets a column still discharging from the last row drop before it is read
+
+const MatrixPins ti83Pins = {
+    ROW_COUNT, COL_COUNT, CLOCK_PIN, DATA_PIN, LATCH_PIN, ONKEY_PIN,
+    {7, 15, 16, 2, 3, 4, 21} // Columns I, J, K, L, M, N, O
+};
+
+static int matrixCount = 0;
+
+// Adds pin to mask, or fails if it is out of range or already there
+static int claimPin(uint32_t *mask, int pin)
+{
+    if (pin < 0 || pin > PIN_MAX || (*mask & (1u << pin))) {
+        return -1;
+    }
+    *mask |= 1u << pin;
+    return 0;
+}
+
+uint32_t gpioPinMask(const MatrixPins *pins)
+{
+    uint32_t mask = 0;
+    int col, clash;
+
+    clash = claimPin(&mask, pins->clockPin) | claimPin(&mask, pins->dataPin) | claimPin(&mask, pins->latchPin);
+    if (pins->onKeyPin >= 0) {
+        clash |= claimPin(&mask, pins->onKeyPin);
+    }
+    for (col = 0; col < pins->cols; col++) {
+        clash |= claimPin(&mask, pins->colPins[col]);
+    }
+    return clash ? 0 : mask;
+}
+
+void gpioMatrixInit(GpioMatrix *matrix, const GpioBackend *backend, const MatrixPins *pins)
+{
+    int row;
+
+    matrix->backend = backend;
+    matrix->pins = *pins;
+    matrix->edges = (EdgeWaiter) { -1, -1, -1 };
+    matrix->lastRowMask = -1;
+    for (row = 0; row < ROW_COUNT; row++) {
+        atomic_init(&matrix->simRows[row], 0);
+    }
+    atomic_init(&matrix->simOnKey, 0);
+    matrix->simSelectedRows = 0;
+}
+
+/*
+ * Edge Waiting
+ *
+ * Edge sources bump an eventfd; waiters sleep on it in epoll alongside
+ * the caller's wake fd.
+ */
+
+static int edgeWaiterInit(EdgeWaiter *waiter)
+{
+    struct epoll_event event;
+
+    waiter->wakeFd = -1;
+    if ((waiter->edgeFd = eventfd(0, EFD_NONBLOCK)) == -1) {
+        return -1;
+    }
+    if ((waiter->epollFd = epoll_create1(0)) == -1) {
+        close(waiter->edgeFd);
+        waiter->edgeFd = -1;
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = waiter->edgeFd;
+    return epoll_ctl(waiter->epollFd, EPOLL_CTL_ADD, waiter->edgeFd, &event);
+}
+
+static void edgeWaiterSignal(EdgeWaiter *waiter)
+{
+    uint64_t one = 1;
+
+    if (write(waiter->edgeFd, &one, sizeof(one)) != sizeof(one)) {
+        // Counter overflow, a wake up is already pending
+    }
+}
+
+static int edgeWaiterWait(GpioMatrix *matrix, int wakeFd, int (*isActive)(GpioMatrix *matrix))
+{
+    EdgeWaiter *waiter = &matrix->edges;
+    struct epoll_event event;
+    uint64_t count;
+
+    if (waiter->edgeFd == -1) {
+        return -1;
+    }
+
+    if (wakeFd != waiter->wakeFd) {
+        if (waiter->wakeFd != -1) {
+            epoll_ctl(waiter->epollFd, EPOLL_CTL_DEL, waiter->wakeFd, NULL);
+        }
+        event.events = EPOLLIN;
+        event.data.fd = wakeFd;
+        epoll_ctl(waiter->epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+        waiter->wakeFd = wakeFd;
+    }
+
+    // Forget edges from active scanning, then make sure nothing went active before sleeping
+    if (read(waiter->edgeFd, &count, sizeof(count)) < 0) {
+        // Nothing pending
+    }
+    if (isActive(matrix)) {
+        return 1;
+    }
+
+    while (epoll_wait(waiter->epollFd, &event, 1, -1) != 1) {
+        // Interrupted, keep waiting
+    }
+
+    return (event.data.fd == waiter->edgeFd) ? 1 : 0;
+}
+
+/*
+ * wiringPi Backend
+ */
+
+// The 74HC595 is shifted directly rather than through wiringPi's sr595 pins,
+// which shift and latch all 8 bits again for every single pin written.
+static volatile uint32_t *gpioRegisters;
+static int wiringPiReady = 0;
+
+// wiringPi interrupts carry no argument, so each matrix gets its own handler
+static GpioMatrix *isrMatrices[MATRIX_MAX];
+
+static void edgeISR0(void) { edgeWaiterSignal(&isrMatrices[0]->edges); }
+static void edgeISR1(void) { edgeWaiterSignal(&isrMatrices[1]->edges); }
+static void edgeISR2(void) { edgeWaiterSignal(&isrMatrices[2]->edges); }
+static void edgeISR3(void) { edgeWaiterSignal(&isrMatrices[3]->edges); }
+
+static void (*const edgeISRs[MATRIX_MAX])(void) = { edgeISR0, edgeISR1, edgeISR2, edgeISR3 };
+
+static void mapGpioRegisters(void)
+{
+    int fd;
+    void *map;
+
+    if ((fd = open(GPIO_MEM_DEVICE, O_RDWR | O_SYNC | O_CLOEXEC)) == -1) {
+        return;
+    }
+    map = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map != MAP_FAILED) {
+        gpioRegisters = map;
+    }
+}
+
+// The GPLEV0 bit of a wiringPi pin, or 0 if its GPIO is past the first register
+static uint32_t registerBit(int pin)
+{
+    int gpio = wpiPinToGpio(pin);
+
+    return (gpio >= 0 && gpio <= PIN_MAX) ? 1u << gpio : 0;
+}
+
+static int findRegisterBits(GpioMatrix *matrix)
+{
+    const MatrixPins *pins = &matrix->pins;
+    int col;
+
+    matrix->clockBit = registerBit(pins->clockPin);
+    matrix->dataBit = registerBit(pins->dataPin);
+    matrix->latchBit = registerBit(pins->latchPin);
+    matrix->onKeyBit = (pins->onKeyPin >= 0) ? registerBit(pins->onKeyPin) : 0;
+    if (!matrix->clockBit || !matrix->dataBit || !matrix->latchBit || (pins->onKeyPin >= 0 && !matrix->onKeyBit)) {
+        return -1;
+    }
+
+    matrix->allColBits = 0;
+    for (col = 0; col < pins->cols; col++) {
+        matrix->colBits[col] = registerBit(pins->colPins[col]);
+        if (!matrix->colBits[col]) {
+            return -1;
+        }
+        matrix->allColBits |= matrix->colBits[col];
+    }
+    return 0;
+}
+
+static inline void setRegisterBits(uint32_t bits)
+{
+    gpioRegisters[GPIO_SET0] = bits;
+}
+
+static inline void clearRegisterBits(uint32_t bits)
+{
+    gpioRegisters[GPIO_CLR0] = bits;
+}
+
+// Holds the lines still between register writes
+static inline void registerHold(void)
+{
+    int i;
+
+    for (i = 0; i < SHIFT_HOLD_READS; i++) {
+        (void) gpioRegisters[GPIO_LEV0];
+    }
+}
+
+// Shift out all 8 row bits (Q7 first, as sr595 does) and latch them once
+static void shiftOutRows(GpioMatrix *matrix, int rowMask)
+{
+    const MatrixPins *pins = &matrix->pins;
+    int bit;
+
+    if (gpioRegisters) {
+        for (bit = 7; bit >= 0; --bit) {
+            if (rowMask & (1 << bit)) {
+                setRegisterBits(matrix->dataBit);
+            } else {
+                clearRegisterBits(matrix->dataBit);
+            }
+            registerHold(); // Data setup
+            setRegisterBits(matrix->clockBit);
+            registerHold(); // Clock pulse width
+            clearRegisterBits(matrix->clockBit);
+            registerHold();
+        }
+        setRegisterBits(matrix->latchBit);
+        registerHold(); // Latch pulse width
+        clearRegisterBits(matrix->latchBit);
+        registerHold();
+    } else {
+        for (bit = 7; bit >= 0; --bit) {
+            digitalWrite(pins->dataPin, rowMask & (1 << bit));
+            digitalWrite(pins->clockPin, HIGH);
+            delayMicroseconds(SR_DELAY_US);
+            digitalWrite(pins->clockPin, LOW);
+            delayMicroseconds(SR_DELAY_US);
+        }
+        digitalWrite(pins->latchPin, HIGH);
+        delayMicroseconds(SR_DELAY_US);
+        digitalWrite(pins->latchPin, LOW);
+        delayMicroseconds(SR_DELAY_US);
+    }
+}
+
+static int wiringPiSetupMatrix(GpioMatrix *matrix)
+{
+    const MatrixPins *pins = &matrix->pins;
+    int i;
+
+    if (matrixCount == MATRIX_MAX) {
+        return -1;
+    }
+    if (!wiringPiReady) {
+        if (wiringPiSetup() == -1) {
+            return -1;
+        }
+        mapGpioRegisters();
+        wiringPiReady = 1;
+    }
+    // A GPIO past 31 would shift its register bit out of range
+    if (findRegisterBits(matrix) == -1) {
+        return -1;
+    }
+    matrix->index = matrixCount++;
+
+    pinMode(pins->dataPin, OUTPUT);
+    pinMode(pins->clockPin, OUTPUT);
+    pinMode(pins->latchPin, OUTPUT);
+    digitalWrite(pins->clockPin, LOW);
+    digitalWrite(pins->latchPin, LOW);
+
+    for (i = 0; i < pins->cols; i++) {   // Set column pins for input, with pulldown.
+        pinMode(pins->colPins[i], INPUT);
+        pullUpDnControl (pins->colPins[i], PUD_DOWN);
+    }
+
+    // Idle mode needs edge interrupts; without them the scanner just keeps polling
+    if (edgeWaiterInit(&matrix->edges) == 0) {
+        isrMatrices[matrix->index] = matrix;
+        for (i = 0; i < pins->cols; i++) {
+            wiringPiISR(pins->colPins[i], INT_EDGE_BOTH, edgeISRs[matrix->index]);
+        }
+        if (pins->onKeyPin >= 0) {
+            wiringPiISR(pins->onKeyPin, INT_EDGE_BOTH, edgeISRs[matrix->index]);
+        }
+    }
+
+    return 0;
+}
+
+static void wiringPiSelectRows(GpioMatrix *matrix, int rowMask)
+{
+    if (rowMask == matrix->lastRowMask) {
+        return;
+    }
+    shiftOutRows(matrix, rowMask);
+    matrix->lastRowMask = rowMask;
+    delayMicroseconds(ROW_SETTLE_US);
+}
+
+// One GPLEV0 sample covers every column, which then only needs gathering into a mask
+static int wiringPiReadColumns(GpioMatrix *matrix)
+{
+    const MatrixPins *pins = &matrix->pins;
+    int col;
+    int columns = 0;
+    uint32_t levels;
+
+    if (gpioRegisters) {
+        levels = gpioRegisters[GPIO_LEV0] & matrix->allColBits;
+        if (levels == 0) {
+            return 0;
+        }
+        for (col = 0; col < pins->cols; col++) {
+            if (levels & matrix->colBits[col]) {
+                columns |= 1 << col;
+            }
+        }
+    } else {
+        for (col = 0; col < pins->cols; col++) {
+            if (digitalRead(pins->colPins[col]) == HIGH) {
+                columns |= 1 << col;
+            }
+        }
+    }
+    return columns;
+}
+
+static int wiringPiReadOnKey(GpioMatrix *matrix)
+{
+    if (matrix->pins.onKeyPin < 0) {
+        return HIGH;
+    }
+    if (gpioRegisters) {
+        return (gpioRegisters[GPIO_LEV0] & matrix->onKeyBit) ? HIGH : LOW;
+    }
+    return digitalRead(matrix->pins.onKeyPin);
+}
+
+static int wiringPiIsActive(GpioMatrix *matrix)
+{
+    return wiringPiReadColumns(matrix) != 0 || wiringPiReadOnKey(matrix) == LOW;
+}
+
+static int wiringPiWaitForEdge(GpioMatrix *matrix, int wakeFd)
+{
+    return edgeWaiterWait(matrix, wakeFd, wiringPiIsActive);
+}
+
+const GpioBackend wiringPiBackend = {
+    "wiringPi",
+    wiringPiSetupMatrix,
+    wiringPiSelectRows,
+    wiringPiReadColumns,
+    wiringPiReadOnKey,
+    wiringPiWaitForEdge
+};
+
+/*
+ * Simulated Backend
+ *
+ * Each row holds a bitmask of the columns whose keys are closed. Keys
+ * may be changed from any thread while the scanner is running, and every
+ * change is also a simulated edge.
+ */
+
+void simSetKey(GpioMatrix *matrix, int row, int col, int pressed)
+{
+    if (pressed) {
+        atomic_fetch_or(&matrix->simRows[row], 1 << col);
+    } else {
+        atomic_fetch_and(&matrix->simRows[row], ~(1 << col));
+    }
+    if (matrix->edges.edgeFd != -1) {
+        edgeWaiterSignal(&matrix->edges);
+    }
+}
+
+void simSetOnKey(GpioMatrix *matrix, int pressed)
+{
+    atomic_store(&matrix->simOnKey, pressed);
+    if (matrix->edges.edgeFd != -1) {
+        edgeWaiterSignal(&matrix->edges);
+    }
+}
+
+// Replace the whole matrix at once, without raising edges
+void simSetMatrix(GpioMatrix *matrix, const uint8_t *rows, int onKeyPressed)
+{
+    int row;
+
+    for (row = 0; row < ROW_COUNT; row++) {
+        atomic_store(&matrix->simRows[row], rows[row]);
+    }
+    atomic_store(&matrix->simOnKey, onKeyPressed);
+}
+
+static int simSetup(GpioMatrix *matrix)
+{
+    if (matrixCount == MATRIX_MAX) {
+        return -1;
+    }
+    matrix->index = matrixCount++;
+    return edgeWaiterInit(&matrix->edges);
+}
+
+static void simSelectRows(GpioMatrix *matrix, int rowMask)
+{
+    matrix->simSelectedRows = rowMask;
+}
+
+static int simReadColumns(GpioMatrix *matrix)
+{
+    int row;
+    int columns = 0;
+
+    for (row = 0; row < matrix->pins.rows; row++) {
+        if (matrix->simSelectedRows & (1 << row)) {
+            columns |= atomic_load(&matrix->simRows[row]);
+        }
+    }
+    return columns & ((1 << matrix->pins.cols) - 1);
+}
+
+static int simReadOnKey(GpioMatrix *matrix)
+{
+    return atomic_load(&matrix->simOnKey) ? LOW : HIGH;
+}
+
+static int simIsActive(GpioMatrix *matrix)
+{
+    return simReadColumns(matrix) != 0 || simReadOnKey(matrix) == LOW;
+}
+
+static int simWaitForEdge(GpioMatrix *matrix, int wakeFd)
+{
+    return edgeWaiterWait(matrix, wakeFd, simIsActive);
+}
+
+const GpioBackend simulatedBackend = {
+    "simulated",
+    simSetup,
+    simSelectRows,
+    simReadColumns,
+    simReadOnKey,
+    simWaitForEdge
+};
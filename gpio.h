@@ -0,0 +1,88 @@
+/***************************************************
+ Filename: gpio.h
+
+ GPIO backends for the keypad matrices. The scanner
+ only talks to a matrix through its GpioBackend, so
+ it can run against a simulated keypad as well. Each
+ GpioMatrix carries its own wiring, so one process
+ can drive several keypads.
+ ***************************************************/
+
+#ifndef gpio_h
+#define gpio_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// WiringPi Pins, not GPIOs
+#define CLOCK_PIN   25
+#define DATA_PIN    27
+#define LATCH_PIN   26
+#define ONKEY_PIN   9
+#define BACKLIGHT_PIN   1
+
+#define ROW_COUNT   8 // Most rows and columns a matrix can have
+#define COL_COUNT   7
+#define ONKEY_ROW   ROW_COUNT // The ON key is reported as an extra row
+#define MATRIX_MAX  4 // Matrices one process can drive
+#define PIN_MAX     31 // Highest pin number; GPLEV0 and the other registers cover GPIOs 0-31
+
+// How one matrix is wired: its rows hang off a 74HC595, its columns off GPIOs
+typedef struct {
+    int rows;       // Up to ROW_COUNT
+    int cols;       // Up to COL_COUNT
+    int clockPin;
+    int dataPin;
+    int latchPin;
+    int onKeyPin;   // -1 without an ON key
+    int colPins[COL_COUNT];
+} MatrixPins;
+
+typedef struct GpioMatrix GpioMatrix;
+
+typedef struct {
+    const char *name;
+    int (*setup)(GpioMatrix *matrix);                 // Returns -1 on failure
+    void (*selectRows)(GpioMatrix *matrix, int rowMask); // Drive the rows in rowMask HIGH
+    int (*readColumns)(GpioMatrix *matrix);           // Bitmask of the active columns, bit n is colPins[n]
+    int (*readOnKey)(GpioMatrix *matrix);             // LOW while the ON key is held
+    int (*waitForEdge)(GpioMatrix *matrix, int wakeFd); // With every row driven, block until a column or ON
+                                                      // edge (1) or until wakeFd is readable (0). -1 if
+                                                      // edges aren't available.
+} GpioBackend;
+
+typedef struct {
+    int edgeFd;
+    int epollFd;
+    int wakeFd;
+} EdgeWaiter;
+
+// One matrix and its backend state
+struct GpioMatrix {
+    const GpioBackend *backend;
+    MatrixPins pins;
+    int index; // Among the matrices set up so far
+    EdgeWaiter edges;
+    int lastRowMask;
+    uint32_t clockBit, dataBit, latchBit, onKeyBit; // wiringPi register bits
+    uint32_t colBits[COL_COUNT];
+    uint32_t allColBits;
+    atomic_int simRows[ROW_COUNT]; // Simulated keys
+    atomic_int simOnKey;
+    int simSelectedRows;
+};
+
+extern const MatrixPins ti83Pins; // The original single keypad wiring
+
+extern const GpioBackend wiringPiBackend;
+extern const GpioBackend simulatedBackend;
+
+void gpioMatrixInit(GpioMatrix *matrix, const GpioBackend *backend, const MatrixPins *pins);
+uint32_t gpioPinMask(const MatrixPins *pins); // A bit per pin the matrix uses; 0 if one is out of range or used twice
+
+// Simulated Matrix
+void simSetKey(GpioMatrix *matrix, int row, int col, int pressed);
+void simSetOnKey(GpioMatrix *matrix, int pressed);
+void simSetMatrix(GpioMatrix *matrix, const uint8_t *rows, int onKeyPressed); // ROW_COUNT column bitmasks
+
+#endif /* gpio_h */
@@ -0,0 +1,215 @@
+/***************************************************
+  Filename: gpiobench.c
+
+  Scans one matrix through the original row drive,
+  eight sr595 pin writes per row and a digitalRead
+  per column, and through the register path in
+  gpio.c, and compares the cost per scan.
+
+  By default wiringPi is replaced by a recording
+  fake that counts every GPIO call and the delays
+  asked for, without sleeping, and the GPIO
+  registers by a file. Built with make gpiobench
+  HW=1 it drives the real pins of a Pi instead.
+
+***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <wiringPi.h>
+#include "gpio.h"
+
+#define SR_PIN_BASE 100 // Where the original driver put the 74HC595's pins
+
+#ifdef HARDWARE
+
+#include <sr595.h>
+
+static int setupPaths(void)
+{
+    return (wiringPiSetup() == -1 || sr595Setup(SR_PIN_BASE, 8, DATA_PIN, CLOCK_PIN, LATCH_PIN) == -1) ? -1 : 0;
+}
+
+#else
+
+static unsigned long writes, reads, delayed; // GPIO calls, and microseconds of delay asked for
+static int levels[64];
+static int shiftRegister;
+
+int wiringPiSetup(void)
+{
+    return 0;
+}
+
+void pinMode(int pin, int mode)
+{
+}
+
+void pullUpDnControl(int pin, int pud)
+{
+}
+
+int wiringPiISR(int pin, int mode, void (*function)(void))
+{
+    return 0;
+}
+
+int wpiPinToGpio(int wpiPin)
+{
+    return wpiPin & 31;
+}
+
+void delayMicroseconds(unsigned int howLong)
+{
+    delayed += howLong;
+}
+
+int digitalRead(int pin)
+{
+    reads++;
+    return levels[pin & 63];
+}
+
+// What wiringPi's sr595 does for every pin written: shift all 8 bits again and latch
+static void sr595Write(int pin, int value)
+{
+    int bit;
+
+    shiftRegister = value ? (shiftRegister | (1 << pin)) : (shiftRegister & ~(1 << pin));
+    for (bit = 7; bit >= 0; --bit) {
+        digitalWrite(DATA_PIN, shiftRegister & (1 << bit));
+        digitalWrite(CLOCK_PIN, HIGH);
+        delayMicroseconds(1);
+        digitalWrite(CLOCK_PIN, LOW);
+        delayMicroseconds(1);
+    }
+    digitalWrite(LATCH_PIN, HIGH);
+    delayMicroseconds(1);
+    digitalWrite(LATCH_PIN, LOW);
+    delayMicroseconds(1);
+}
+
+void digitalWrite(int pin, int value)
+{
+    if (pin >= SR_PIN_BASE) {
+        sr595Write(pin - SR_PIN_BASE, value);
+        return;
+    }
+    writes++;
+    levels[pin & 63] = value;
+}
+
+// The register path maps this file instead of /dev/gpiomem
+static int setupPaths(void)
+{
+    int fd = open(GPIO_MEM_DEVICE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+    if (fd == -1 || ftruncate(fd, 4096) == -1) {
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+#endif
+
+static uint64_t nanos(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// The original driver's setValue()
+static void oldSelectRows(int rowMask)
+{
+    int bit;
+
+    for (bit = 0; bit < 8; ++bit) {
+        digitalWrite(SR_PIN_BASE + bit, rowMask & (1 << bit));
+    }
+}
+
+static void oldScan(void)
+{
+    int row, col;
+
+    for (row = 0; row < ROW_COUNT; row++) {
+        oldSelectRows(1 << row);
+        for (col = 0; col < COL_COUNT; col++) {
+            digitalRead(ti83Pins.colPins[col]);
+        }
+    }
+    digitalRead(ONKEY_PIN);
+}
+
+static void newScan(GpioMatrix *matrix)
+{
+    int row;
+
+    for (row = 0; row < matrix->pins.rows; row++) {
+        matrix->backend->selectRows(matrix, 1 << row);
+        matrix->backend->readColumns(matrix);
+    }
+    matrix->backend->readOnKey(matrix);
+}
+
+static void report(const char *path, uint64_t time, int scans)
+{
+#ifdef HARDWARE
+    printf("  %-22s %10.2f us\n", path, time / 1000.0 / scans);
+#else
+    // Nothing sleeps, so the time is the CPU cost alone and the delays come on top
+    printf("  %-22s %10.2f us %10.1f us %10.1f %10.1f\n", path, time / 1000.0 / scans,
+           (double) delayed / scans, (double) writes / scans, (double) reads / scans);
+    writes = reads = delayed = 0;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    int scans = (argc > 1) ? atoi(argv[1]) : 100000;
+    GpioMatrix matrix;
+    uint64_t start;
+    int i;
+
+    if (scans <= 0 || setupPaths() == -1) {
+        fprintf(stderr, "Usage: gpiobench [scans], as root on a Pi with HW=1\n");
+        exit(1);
+    }
+    gpioMatrixInit(&matrix, &wiringPiBackend, &ti83Pins);
+    if (wiringPiBackend.setup(&matrix) == -1) {
+        fprintf(stderr, "GPIO setup failed\n");
+        exit(1);
+    }
+
+#ifdef HARDWARE
+    printf("%d scans of %d rows x %d columns on the Pi's GPIO\n", scans, ROW_COUNT, COL_COUNT);
+    printf("  Path                    Time/scan\n");
+#else
+    printf("%d scans of %d rows x %d columns, recording fake wiringPi\n", scans, ROW_COUNT, COL_COUNT);
+    printf("  Path                    Time/scan  Delay/scan  Writes/scan  Reads/scan\n");
+#endif
+
+    start = nanos();
+    for (i = 0; i < scans; i++) {
+        oldScan();
+    }
+    report("sr595 + digitalRead", nanos() - start, scans);
+
+    start = nanos();
+    for (i = 0; i < scans; i++) {
+        newScan(&matrix);
+    }
+    report("Registers (gpio.c)", nanos() - start, scans);
+
+#ifndef HARDWARE
+    unlink(GPIO_MEM_DEVICE);
+#endif
+    return 0;
+}
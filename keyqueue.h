@@ -0,0 +1,81 @@
+/***************************************************
+ Filename: keyqueue.h
+
+ Lock-free single-producer/single-consumer ring
+ buffer carrying key events from the scanner thread
+ to the injection side.
+ ***************************************************/
+
+#ifndef keyqueue_h
+#define keyqueue_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// Event Types
+#define EVENT_PRESS 1
+#define EVENT_RELEASE 2
+#define EVENT_CHORD 3 // row holds the CHORD_* action, col the chord's index
+
+#define KEY_QUEUE_SIZE 256 // Must be a power of two
+
+typedef struct {
+    uint64_t timestamp; // CLOCK_MONOTONIC, in nanoseconds, when the event was accepted
+    uint64_t detected;  // When the raw contact change was first seen
+    uint8_t type;
+    uint8_t row;
+    uint8_t col;
+} KeyEvent;
+
+typedef struct {
+    // Keep the indices on separate cache lines so the two threads don't fight over them
+    _Alignas(64) atomic_uint head; // Only written by the consumer
+    _Alignas(64) atomic_uint tail; // Only written by the producer
+    KeyEvent events[KEY_QUEUE_SIZE];
+} KeyQueue;
+
+static inline uint64_t monotonicNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void keyQueueInit(KeyQueue *queue)
+{
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+// Producer side. Returns 0 if the queue is full.
+static inline int keyQueuePush(KeyQueue *queue, const KeyEvent *event)
+{
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (tail - head == KEY_QUEUE_SIZE) {
+        return 0;
+    }
+
+    queue->events[tail & (KEY_QUEUE_SIZE - 1)] = *event;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+// Consumer side. Returns 0 if the queue is empty.
+static inline int keyQueuePop(KeyQueue *queue, KeyEvent *event)
+{
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head == tail) {
+        return 0;
+    }
+
+    *event = queue->events[head & (KEY_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return 1;
+}
+
+#endif /* keyqueue_h */
@@ -0,0 +1,67 @@
+/***************************************************
+ Filename: layoutfile.c
+
+***************************************************/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "layoutfile.h"
+
+// Section names in layout files
+const char *layoutModeNames[LAYOUT_MODES] = {
+    "normal", "alpha-lower", "alpha-upper", "second", "ti83"
+};
+
+// Indexed by special - SPECIAL_ALPHA_UPPER_KEY
+const char *layoutSpecialNames[] = {
+    "SPECIAL_ALPHA_UPPER_KEY",
+    "SPECIAL_ALPHA_LOWER_KEY",
+    "SPECIAL_2ND_KEY",
+    "SPECIAL_LOCK_KEY",
+    "SPECIAL_NORMAL_KEY",
+    "SPECIAL_BRIGHT_UP_KEY",
+    "SPECIAL_BRIGHT_DOWN_KEY",
+    "SPECIAL_CONTROL_LOCK",
+    NULL
+};
+
+// Returns NULL if path isn't a layout image for this matrix
+const LayoutImage *layoutImageMap(const char *path)
+{
+    struct stat info;
+    const LayoutImage *image;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &info) == -1 || info.st_size != sizeof(LayoutImage)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, sizeof(LayoutImage), PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    image = map;
+    if (memcmp(image->magic, LAYOUT_MAGIC, 8) != 0 || image->modes != LAYOUT_MODES ||
+        image->rows != ROW_COUNT || image->cols != COL_COUNT) {
+        layoutImageUnmap(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+void layoutImageUnmap(const LayoutImage *image)
+{
+    if (image != NULL) {
+        munmap((void *) image, sizeof(LayoutImage));
+    }
+}
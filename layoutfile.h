@@ -0,0 +1,51 @@
+/***************************************************
+ Filename: layoutfile.h
+
+ Compiled layout images, as written by ti83layout
+ from a text layout file. An image is a fixed-size
+ header followed by the keysym of every mode, row
+ and column, then the macro table, so the driver can
+ mmap it and use it in place. Images use the host's
+ byte order.
+ ***************************************************/
+
+#ifndef layoutfile_h
+#define layoutfile_h
+
+#include <stdint.h>
+#include "gpio.h"
+
+#define LAYOUT_MAGIC    "T83LAYT2"
+#define LAYOUT_MODES    5 // Normal, alpha lower, alpha upper, 2nd, TI-83; in MODE_* order
+#define LAYOUT_MACROS   32
+#define LAYOUT_STEPS    64 // Per macro
+#define LAYOUT_PAUSE    0x40000000 // Macro step that pauses for the low bits in milliseconds
+
+// None of the defined KeySymbols are in the 0x8000 range
+#define SPECIAL_ALPHA_UPPER_KEY       0x8000
+#define SPECIAL_ALPHA_LOWER_KEY       0x8001
+#define SPECIAL_2ND_KEY               0x8002
+#define SPECIAL_LOCK_KEY              0x8003
+#define SPECIAL_NORMAL_KEY            0x8004
+#define SPECIAL_BRIGHT_UP_KEY         0x8005
+#define SPECIAL_BRIGHT_DOWN_KEY       0x8006
+#define SPECIAL_CONTROL_LOCK          0x8007
+#define SPECIAL_MACRO_KEY             0x8100 // Plus the macro number, up to LAYOUT_MACROS
+
+typedef struct {
+    char magic[8];
+    uint32_t modes;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t reserved;
+    uint32_t symbols[LAYOUT_MODES][ROW_COUNT][COL_COUNT]; // Indexed by mode - 1
+    uint32_t macros[LAYOUT_MACROS][LAYOUT_STEPS]; // Keysyms and pauses, ending at NoSymbol
+} LayoutImage;
+
+extern const char *layoutModeNames[LAYOUT_MODES];
+extern const char *layoutSpecialNames[];
+
+const LayoutImage *layoutImageMap(const char *path);
+void layoutImageUnmap(const LayoutImage *image);
+
+#endif /* layoutfile_h */
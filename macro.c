@@ -0,0 +1,113 @@
+/***************************************************
+ Filename: macro.c
+
+***************************************************/
+
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "macro.h"
+
+static int timerFd = -1;
+static MacroEvent queue[MACRO_QUEUE_SIZE];
+static unsigned int head = 0, tail = 0;
+static int isScheduled = 0;
+
+// Zero means as soon as possible rather than disarm
+static void armTimer(unsigned int milliseconds)
+{
+    struct itimerspec timer = {{0, 0}, {0, 0}};
+
+    timer.it_value.tv_sec = milliseconds / 1000;
+    timer.it_value.tv_nsec = (milliseconds % 1000) * 1000000L;
+    if (milliseconds == 0) {
+        timer.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(timerFd, 0, &timer, NULL);
+}
+
+int macroInit(void)
+{
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return (timerFd == -1) ? -1 : 0;
+}
+
+int macroFd(void)
+{
+    return timerFd;
+}
+
+int macroPending(void)
+{
+    return tail - head;
+}
+
+// Queues a whole expansion or nothing; returns -1 if it won't fit
+int macroQueue(const MacroEvent *events, int count)
+{
+    int i;
+
+    if (timerFd == -1 || count > MACRO_QUEUE_SIZE - macroPending()) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        queue[tail++ & (MACRO_QUEUE_SIZE - 1)] = events[i];
+    }
+    return 0;
+}
+
+// Arms the timer for the next batch, if there is one and it isn't already armed
+void macroSchedule(int canDelay)
+{
+    if (isScheduled || macroPending() == 0) {
+        return;
+    }
+    isScheduled = 1;
+    armTimer(canDelay ? 0 : queue[head & (MACRO_QUEUE_SIZE - 1)].delay);
+}
+
+// Takes the events due now. Without canDelay a batch ends before the
+// next pause, which the timer then waits out, and the pause of the
+// first event has already passed.
+int macroNext(MacroEvent *events, int max, int canDelay)
+{
+    uint64_t expirations;
+    int count = 0;
+
+    if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return 0;
+    }
+    isScheduled = 0;
+
+    while (count < max && macroPending() > 0) {
+        events[count] = queue[head & (MACRO_QUEUE_SIZE - 1)];
+        if (!canDelay) {
+            if (count > 0 && events[count].delay > 0) {
+                break;
+            }
+            events[count].delay = 0;
+        }
+        head++;
+        count++;
+    }
+
+    return count;
+}
+
+// Drops everything queued. Returns 1 with release filled in when the next
+// event is the release of a key already pressed, which the caller still
+// owes the output.
+int macroCancel(MacroEvent *release)
+{
+    struct itimerspec disarm = {{0, 0}, {0, 0}};
+    int owed = (macroPending() > 0 && !queue[head & (MACRO_QUEUE_SIZE - 1)].isPress);
+
+    if (owed) {
+        *release = queue[head & (MACRO_QUEUE_SIZE - 1)];
+    }
+    head = tail;
+    if (isScheduled) {
+        isScheduled = 0;
+        timerfd_settime(timerFd, 0, &disarm, NULL);
+    }
+    return owed;
+}
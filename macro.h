@@ -0,0 +1,38 @@
+/***************************************************
+ Filename: macro.h
+
+ Macro playback queue. Expanded macros are queued
+ as individual key events, each carrying the pause
+ before it, and played back from the main loop in
+ batches. A timerfd schedules the next batch, so a
+ long macro never stalls the loop and a pause never
+ sleeps. When the output backend can delay events
+ itself, pauses travel with the events instead and
+ whole batches go out at once. Mode changes, layout
+ reloads and shutdown cancel what is still queued.
+ ***************************************************/
+
+#ifndef macro_h
+#define macro_h
+
+#include <stdint.h>
+
+#define MACRO_QUEUE_SIZE    1024 // Power of two
+#define MACRO_BATCH_SIZE    32   // Most events sent per flush
+
+typedef struct {
+    uint16_t delay;     // Milliseconds to wait before this event
+    uint8_t keycode;
+    uint8_t isPress;
+    uint8_t modifiers;  // What a press wants held, for the modifier tracker
+} MacroEvent;
+
+int macroInit(void);
+int macroFd(void);
+int macroQueue(const MacroEvent *events, int count);
+int macroNext(MacroEvent *events, int max, int canDelay);
+void macroSchedule(int canDelay);
+int macroPending(void);
+int macroCancel(MacroEvent *release);
+
+#endif /* macro_h */
@@ -0,0 +1,60 @@
+/***************************************************
+ Filename: modes.c
+
+***************************************************/
+
+#include "modes.h"
+
+// Steps for ordinary keys and macros, taken on press
+#define STAY        { NEXT_STAY, 0 }
+#define BACK        { NEXT_LAST, 0 }                        // 2nd covers one key
+#define ALPHA_KEY   { MODE_NORMAL, STEP_UNLESS_ALPHA_LOCK } // One letter, then back to normal unless locked
+
+// Steps for mode keys, taken on release
+#define UPPER       { MODE_ALPHA_UPPER, STEP_ON_RELEASE }
+#define LOWER       { MODE_ALPHA_LOWER, STEP_ON_RELEASE }
+#define SECOND      { MODE_SECOND, STEP_ON_RELEASE }
+#define NORMAL      { MODE_NORMAL, STEP_ON_RELEASE }
+#define BRIGHTER    { MODE_NORMAL, STEP_ON_RELEASE | STEP_BRIGHT_UP }
+#define DIMMER      { MODE_NORMAL, STEP_ON_RELEASE | STEP_BRIGHT_DOWN }
+#define CONTROL     { NEXT_STAY, STEP_ON_RELEASE | STEP_CONTROL_LOCK }
+#define LOCK        { NEXT_ALPHA, STEP_ON_RELEASE | STEP_ALPHA_LOCK }
+#define NO_LOCK     { NEXT_STAY, STEP_ON_RELEASE }          // Alpha lock only works after 2nd
+
+// One row per mode, one entry per action. The macro takes every action by
+// position, so a row that misses one doesn't compile.
+#define MODE_ROW(key, alphaUpper, alphaLower, second, lock, normal, brightUp, brightDown, controlLock, macro) \
+    { [ACTION_KEY] = key, [ACTION_ALPHA_UPPER] = alphaUpper, [ACTION_ALPHA_LOWER] = alphaLower,             \
+      [ACTION_SECOND] = second, [ACTION_LOCK] = lock, [ACTION_NORMAL] = normal,                             \
+      [ACTION_BRIGHT_UP] = brightUp, [ACTION_BRIGHT_DOWN] = brightDown,                                     \
+      [ACTION_CONTROL_LOCK] = controlLock, [ACTION_MACRO] = macro }
+
+_Static_assert(ACTION_COUNT == 10, "MODE_ROW needs an entry for every action");
+
+const ModeStep modeTransitions[][ACTION_COUNT] = {
+    //        key        upper  lower  2nd     lock     normal  bright+   bright-  control  macro
+    MODE_ROW(STAY,      UPPER, LOWER, SECOND, NO_LOCK, NORMAL, BRIGHTER, DIMMER, CONTROL, STAY),       // MODE_NORMAL
+    MODE_ROW(ALPHA_KEY, UPPER, LOWER, SECOND, NO_LOCK, NORMAL, BRIGHTER, DIMMER, CONTROL, ALPHA_KEY),  // MODE_ALPHA_LOWER
+    MODE_ROW(ALPHA_KEY, UPPER, LOWER, SECOND, NO_LOCK, NORMAL, BRIGHTER, DIMMER, CONTROL, ALPHA_KEY),  // MODE_ALPHA_UPPER
+    MODE_ROW(BACK,      UPPER, LOWER, SECOND, LOCK,    NORMAL, BRIGHTER, DIMMER, CONTROL, BACK),       // MODE_SECOND
+    MODE_ROW(STAY,      UPPER, LOWER, SECOND, NO_LOCK, NORMAL, BRIGHTER, DIMMER, CONTROL, STAY)        // MODE_TI83
+};
+
+_Static_assert(sizeof(modeTransitions) / sizeof(modeTransitions[0]) == MODE_COUNT - 1,
+               "modeTransitions needs a row for every mode");
+
+const signed char alphaLockModes[MODE_COUNT] = {
+    [MODE_NORMAL] = MODE_ALPHA_LOWER,
+    [MODE_ALPHA_LOWER] = MODE_ALPHA_LOWER,
+    [MODE_ALPHA_UPPER] = MODE_ALPHA_UPPER,
+    [MODE_SECOND] = NEXT_STAY,
+    [MODE_TI83] = NEXT_STAY
+};
+
+const unsigned char modeClearsLocks[MODE_COUNT] = {
+    [MODE_NORMAL] = STEP_ALPHA_LOCK | STEP_CONTROL_LOCK,
+    [MODE_ALPHA_LOWER] = 0,
+    [MODE_ALPHA_UPPER] = 0,
+    [MODE_SECOND] = STEP_CONTROL_LOCK,
+    [MODE_TI83] = STEP_ALPHA_LOCK | STEP_CONTROL_LOCK
+};
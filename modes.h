@@ -0,0 +1,86 @@
+/***************************************************
+ Filename: modes.h
+
+ The keypad's mode state machine. Each layout entry
+ resolves once, when the key table is built, to a
+ mode action; a key event then costs one lookup in
+ the transition table, by mode and action, to learn
+ what it does to the mode and lock flags.
+
+ Mode keys act when released and send nothing;
+ ordinary keys and macros take their step when
+ pressed, before they are sent.
+ ***************************************************/
+
+#ifndef modes_h
+#define modes_h
+
+#include "layoutfile.h"
+
+// Mode corresponds to the keyboard layout used as well as the icon displayed
+#define MODE_NORMAL 1       // numbers.png
+#define MODE_ALPHA_LOWER 2  // lowercase.png
+#define MODE_ALPHA_UPPER 3  // uppercase.png
+#define MODE_SECOND 4       // 2nd.png
+#define MODE_TI83 5         // ti83mode.png
+#define MODE_COUNT  (MODE_TI83 + 1) // For tables indexed by mode, 0 unused
+#define MODE_BIT(mode)  (1 << (mode)) // For sets of modes
+
+// What a layout entry does to the mode. The special ones follow SPECIAL_* order.
+enum {
+    ACTION_KEY,             // Ordinary keys, and keys with nothing to send
+    ACTION_ALPHA_UPPER,
+    ACTION_ALPHA_LOWER,
+    ACTION_SECOND,
+    ACTION_LOCK,
+    ACTION_NORMAL,
+    ACTION_BRIGHT_UP,
+    ACTION_BRIGHT_DOWN,
+    ACTION_CONTROL_LOCK,
+    ACTION_MACRO,
+    ACTION_COUNT
+};
+
+_Static_assert(ACTION_CONTROL_LOCK - ACTION_ALPHA_UPPER == SPECIAL_CONTROL_LOCK - SPECIAL_ALPHA_UPPER_KEY,
+               "Mode actions must follow the SPECIAL_* keysyms");
+
+// Where a step leaves the mode: a MODE_* or one of these
+#define NEXT_STAY   0   // Where it is
+#define NEXT_LAST   -1  // Back to the mode before
+#define NEXT_ALPHA  -2  // The alpha case the mode before implies (alphaLockModes)
+
+// Step flags
+#define STEP_ON_RELEASE         0x01 // A mode key: steps on release and sends nothing
+#define STEP_UNLESS_ALPHA_LOCK  0x02 // No step at all while alpha lock is on
+#define STEP_ALPHA_LOCK         0x04 // Toggle alpha lock
+#define STEP_CONTROL_LOCK       0x08 // Toggle control lock
+#define STEP_BRIGHT_UP          0x10
+#define STEP_BRIGHT_DOWN        0x20
+
+typedef struct {
+    signed char next;
+    unsigned char flags;
+} ModeStep;
+
+extern const ModeStep modeTransitions[][ACTION_COUNT]; // Indexed by mode - 1, action
+extern const signed char alphaLockModes[MODE_COUNT];    // Indexed by the mode before alpha lock
+extern const unsigned char modeClearsLocks[MODE_COUNT]; // STEP_*_LOCK flags entering each mode clears
+
+// The action a layout entry resolves to
+static inline int modeAction(unsigned int keySym)
+{
+    if (keySym >= SPECIAL_ALPHA_UPPER_KEY && keySym <= SPECIAL_CONTROL_LOCK) {
+        return ACTION_ALPHA_UPPER + (keySym - SPECIAL_ALPHA_UPPER_KEY);
+    }
+    if (keySym >= SPECIAL_MACRO_KEY && keySym < SPECIAL_MACRO_KEY + LAYOUT_MACROS) {
+        return ACTION_MACRO;
+    }
+    return ACTION_KEY;
+}
+
+static inline ModeStep modeStep(int mode, int action)
+{
+    return modeTransitions[mode - 1][action];
+}
+
+#endif /* modes_h */
@@ -0,0 +1,79 @@
+/***************************************************
+  Filename: modetest.c
+
+  Presses and releases every key from every
+  combination of mode, last mode and locks, through
+  the driver's own handleKeyEvent(), printing one
+  line per case: the layout entry, the keys sent, and
+  the mode, last mode, locks and brightness after the
+  press and after the release. make test compares
+  this with modes.golden.
+
+  The driver is built into this file, with its main()
+  renamed, so the walk can reach its keypad state
+  without any of it living in the driver itself.
+
+***************************************************/
+
+#define main driverMain
+#include "ti83keypad.c"
+#undef main
+
+// Prints each key the walk injects, on the line of its case
+static void walkSendKey(KeyCode keycode, Bool isPress)
+{
+    printf(" %d%s", keycode, isPress ? "v" : "^");
+}
+
+int main(int argc, char *argv[])
+{
+    static OutputBackend walkOutput;
+    Keypad *keypad;
+    KeyEvent event = { 0, 0, EVENT_PRESS, 0, 0 };
+    int mode, lastMode, alphaLock, controlLock, row, col;
+
+    gpio = &simulatedBackend;
+    walkOutput = countingOutput;
+    walkOutput.sendKey = walkSendKey;
+    output = &walkOutput;
+    isRepeatEnabled = FALSE;
+    addKeypad(&ti83Pins);
+    setup();
+    keypad = &keypads[0];
+    // Mode and brightness chatter would break up the lines
+    g_set_print_handler(discardPrint);
+
+    for (mode = MODE_NORMAL; mode < MODE_COUNT; mode++) {
+        for (lastMode = MODE_NORMAL; lastMode < MODE_COUNT; lastMode++) {
+            for (alphaLock = 0; alphaLock < 2; alphaLock++) {
+                for (controlLock = 0; controlLock < 2; controlLock++) {
+                    for (row = 0; row <= ONKEY_ROW; row++) {
+                        for (col = 0; col < COL_COUNT; col++) {
+                            keypad->mode = mode;
+                            keypad->lastMode = lastMode;
+                            keypad->isAlphaLockActive = alphaLock;
+                            keypad->isControlLockActive = controlLock;
+                            brightness = MAX_BRIGHTNESS / 2;
+                            event.row = row;
+                            event.col = col;
+                            printf("%d %d %d %d %d,%d %lx:", mode, lastMode, alphaLock, controlLock, row, col,
+                                   (unsigned long) getKeySymbol(mode, row, col));
+
+                            event.type = EVENT_PRESS;
+                            handleKeyEvent(keypad, &event);
+                            printf(" | %d %d %d %d %d |", keypad->mode, keypad->lastMode, keypad->isAlphaLockActive,
+                                   keypad->isControlLockActive, brightness);
+                            event.type = EVENT_RELEASE;
+                            handleKeyEvent(keypad, &event);
+                            modifiersReleaseAll();
+                            printf(" | %d %d %d %d %d\n", keypad->mode, keypad->lastMode, keypad->isAlphaLockActive,
+                                   keypad->isControlLockActive, brightness);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
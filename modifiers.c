@@ -0,0 +1,98 @@
+/***************************************************
+ Filename: modifiers.c
+
+***************************************************/
+
+#include "modifiers.h"
+
+static const unsigned char modifierMasks[] = { ShiftMask, ControlMask }; // Pressed in this order
+static KeyCode modifierKeycodes[2];
+static ModifierSend sendKey = NULL;
+static unsigned char held = 0; // Modifiers down on the output
+static int heldKeys = 0; // Keys down that were pressed through the tracker
+
+static void apply(unsigned char wanted)
+{
+    ModifierChange changes[MODIFIER_CHANGES];
+    int i, count;
+
+    count = modifiersPlan(&held, wanted, changes);
+    for (i = 0; i < count; i++) {
+        sendKey(changes[i].keycode, changes[i].isPress);
+    }
+}
+
+// Anything held under the old keycodes is released first
+void modifiersSetOutput(ModifierSend send, KeyCode shift, KeyCode control)
+{
+    if (sendKey != NULL) {
+        modifiersReleaseAll();
+    }
+    sendKey = send;
+    modifierKeycodes[0] = shift;
+    modifierKeycodes[1] = control;
+}
+
+// Fills changes with the presses and releases that take *held to wanted,
+// updating *held. Releases come first, in the reverse of press order.
+int modifiersPlan(unsigned char *held, unsigned char wanted, ModifierChange *changes)
+{
+    int i, count = 0;
+
+    for (i = sizeof(modifierMasks) - 1; i >= 0; i--) {
+        if ((*held & modifierMasks[i]) && !(wanted & modifierMasks[i]) && modifierKeycodes[i] != 0) {
+            changes[count++] = (ModifierChange) { modifierKeycodes[i], False };
+        }
+    }
+    for (i = 0; i < (int) sizeof(modifierMasks); i++) {
+        if (!(*held & modifierMasks[i]) && (wanted & modifierMasks[i]) && modifierKeycodes[i] != 0) {
+            changes[count++] = (ModifierChange) { modifierKeycodes[i], True };
+        }
+    }
+    *held = wanted;
+    return count;
+}
+
+unsigned char modifiersHeld(void)
+{
+    return held;
+}
+
+// Before sending a key that needs exactly wanted
+void modifiersKeyPress(unsigned char wanted)
+{
+    apply(wanted);
+    heldKeys++;
+}
+
+// After sending a key's release. Keys still held keep what they share,
+// less dropNow, which one-shot modifiers never lend; the last key
+// releases everything.
+void modifiersKeyRelease(unsigned char dropNow)
+{
+    if (heldKeys > 0) {
+        heldKeys--;
+    }
+    apply((heldKeys > 0) ? held & ~dropNow : 0);
+}
+
+void modifiersReleaseAll(void)
+{
+    if (sendKey != NULL) {
+        apply(0);
+    }
+}
+
+// For macros, which send their own events and may delay them: fills
+// changes with the transitions to wanted before the next step's key
+int modifiersChange(unsigned char wanted, ModifierChange *changes)
+{
+    return modifiersPlan(&held, wanted, changes);
+}
+
+// After a macro's last step: the releases it leaves to send, unless
+// a key held since still needs its modifiers
+int modifiersSettle(ModifierChange *changes)
+{
+    return (heldKeys > 0) ? 0 : modifiersPlan(&held, 0, changes);
+}
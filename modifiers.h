@@ -0,0 +1,38 @@
+/***************************************************
+ Filename: modifiers.h
+
+ Tracks which modifiers are held on the output and
+ sends only the transitions needed to reach the set
+ the next key wants. Shift stays down while keys that
+ want it overlap, so rolling over "ABC" costs one
+ Shift press and one release, and is released as
+ soon as no held key needs it. Macros move the same
+ held set step by step, so a shifted run inside one
+ shares a Shift too. Mode changes and shutdown call
+ modifiersReleaseAll() to leave the output clean.
+ ***************************************************/
+
+#ifndef modifiers_h
+#define modifiers_h
+
+#include <X11/Xlib.h>
+
+#define MODIFIER_CHANGES    4 // Most transitions between two modifier sets
+
+typedef void (*ModifierSend)(KeyCode keycode, Bool isPress);
+
+typedef struct {
+    KeyCode keycode;
+    Bool isPress;
+} ModifierChange;
+
+void modifiersSetOutput(ModifierSend send, KeyCode shift, KeyCode control);
+int modifiersPlan(unsigned char *held, unsigned char wanted, ModifierChange *changes);
+unsigned char modifiersHeld(void);
+void modifiersKeyPress(unsigned char wanted);
+void modifiersKeyRelease(unsigned char dropNow);
+void modifiersReleaseAll(void);
+int modifiersChange(unsigned char wanted, ModifierChange *changes);
+int modifiersSettle(ModifierChange *changes);
+
+#endif /* modifiers_h */
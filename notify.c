@@ -0,0 +1,295 @@
+/***************************************************
+ Filename: notify.c
+
+***************************************************/
+
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <signal.h>
+#include <unistd.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "eventloop.h"
+#include "notify.h"
+
+const char *notifyModeNames[NOTIFY_MODES] = {
+    "", "Normal", "Alpha Lower", "Alpha Upper", "2nd", "TI-83"
+};
+
+// Tray icons in images/
+const char *notifyModeIcons[NOTIFY_MODES] = {
+    "", "numbers.png", "lowercase.png", "uppercase.png", "2nd.png", "ti83mode.png"
+};
+
+static int clients[NOTIFY_CLIENTS];
+static int clientCount = 0;
+static int currentMode = 0;
+static char hello[NOTIFY_LINE] = "";
+static NotifyCommand commandHandler = NULL;
+
+// Fills address for name, with a leading @ or none meaning the abstract namespace
+static socklen_t socketAddress(struct sockaddr_un *address, const char *name)
+{
+    size_t length = strlen(name);
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (name[0] == '/') {
+        if (length >= sizeof(address->sun_path)) {
+            return 0;
+        }
+        memcpy(address->sun_path, name, length);
+    } else {
+        if (name[0] == '@') {
+            name++;
+            length--;
+        }
+        if (length + 1 > sizeof(address->sun_path)) {
+            return 0;
+        }
+        memcpy(address->sun_path + 1, name, length);
+        length++;
+    }
+    return offsetof(struct sockaddr_un, sun_path) + length;
+}
+
+static int sendLine(int fd, const char *line, size_t length)
+{
+    ssize_t sent = send(fd, line, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    // Not a socket, so an --mode-fd pipe or file
+    if (sent == -1 && errno == ENOTSOCK) {
+        sent = write(fd, line, length);
+    }
+    return (sent == (ssize_t) length) ? 0 : -1;
+}
+
+static int sendMode(int fd, int mode)
+{
+    char line[64];
+    int length = snprintf(line, sizeof(line), "mode %d %s\n", mode, notifyModeNames[mode]);
+
+    return sendLine(fd, line, length);
+}
+
+// Returns the listening socket for the main loop to watch, or -1
+int notifyListen(const char *name, int mode)
+{
+    struct sockaddr_un address;
+    socklen_t length;
+    int fd;
+
+    currentMode = mode;
+    if ((length = socketAddress(&address, name)) == 0) {
+        return -1;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *) &address, length) == -1 || listen(fd, NOTIFY_CLIENTS) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int isClient(int fd)
+{
+    int i;
+
+    for (i = 0; i < clientCount; i++) {
+        if (clients[i] == fd) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void dropClient(int fd)
+{
+    int i;
+
+    for (i = 0; i < clientCount; i++) {
+        if (clients[i] == fd) {
+            clients[i] = clients[--clientCount];
+            break;
+        }
+    }
+    loopUnwatchFd(fd);
+    close(fd);
+}
+
+// Commands are short, so each is expected whole within a single read
+static void readCommands(int fd, void *data)
+{
+    char buffer[NOTIFY_LINE];
+    char *line;
+    char *end;
+    ssize_t length = recv(fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+
+    if (length == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (length <= 0) {
+        dropClient(fd);
+        return;
+    }
+
+    buffer[length] = '\0';
+    for (line = buffer; (end = strchr(line, '\n')) != NULL && isClient(fd); line = end + 1) {
+        *end = '\0';
+        if (commandHandler != NULL) {
+            commandHandler(fd, line);
+        }
+    }
+}
+
+// Root, the driver's own user and members of NOTIFY_GROUP, by primary or supplementary group
+static int peerAllowed(int fd)
+{
+    struct ucred peer;
+    socklen_t length = sizeof(peer);
+    const struct group *allowed;
+    const struct passwd *user;
+    gid_t groups[64];
+    int count = sizeof(groups) / sizeof(groups[0]);
+    int i;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == -1) {
+        return 0;
+    }
+    if (peer.uid == 0 || peer.uid == geteuid()) {
+        return 1;
+    }
+    if ((allowed = getgrnam(NOTIFY_GROUP)) == NULL) {
+        return 0;
+    }
+    if (peer.gid == allowed->gr_gid) {
+        return 1;
+    }
+    if ((user = getpwuid(peer.uid)) == NULL || getgrouplist(user->pw_name, peer.gid, groups, &count) == -1) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        if (groups[i] == allowed->gr_gid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void notifyAccept(int listenFd)
+{
+    int fd;
+
+    while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        if (!peerAllowed(fd)) {
+            close(fd);
+        } else if (hello[0] != '\0' && sendLine(fd, hello, strlen(hello)) == -1) {
+            close(fd);
+        } else if (notifyAddFd(fd) == -1) {
+            close(fd);
+        } else if (loopWatch(fd, readCommands, NULL) == -1) {
+            dropClient(fd);
+        }
+    }
+}
+
+// A line sent to every socket client before the mode, ending in a newline
+void notifySetHello(const char *line)
+{
+    snprintf(hello, sizeof(hello), "%s", line);
+}
+
+// Called on the main loop with each line a socket client sends
+void notifySetCommands(NotifyCommand handler)
+{
+    commandHandler = handler;
+}
+
+int notifyReply(int fd, const char *line)
+{
+    return sendLine(fd, line, strlen(line));
+}
+
+// Also sends the current mode straight away
+int notifyAddFd(int fd)
+{
+    if (clientCount == NOTIFY_CLIENTS) {
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // A pipe reader going away shouldn't end the driver
+    clients[clientCount++] = fd;
+    if (currentMode != 0) {
+        sendMode(fd, currentMode);
+    }
+    return 0;
+}
+
+// Clients that can't keep up or have gone away are dropped
+void notifyMode(int mode)
+{
+    char status[64];
+    int i;
+
+    currentMode = mode;
+    for (i = 0; i < clientCount; ) {
+        if (sendMode(clients[i], mode) == -1) {
+            dropClient(clients[i]);
+        } else {
+            i++;
+        }
+    }
+
+    snprintf(status, sizeof(status), "STATUS=Mode: %s", notifyModeNames[mode]);
+    notifySystemd(status);
+}
+
+// sd_notify() without libsystemd: one datagram to $NOTIFY_SOCKET
+void notifySystemd(const char *state)
+{
+    const char *path = getenv("NOTIFY_SOCKET");
+    struct sockaddr_un address;
+    socklen_t length;
+    int fd;
+
+    if (path == NULL || (path[0] != '/' && path[0] != '@')) {
+        return;
+    }
+    if ((length = socketAddress(&address, path)) == 0) {
+        return;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1) {
+        return;
+    }
+    if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *) &address, length) == -1) {
+        // Nothing to be done; systemd will time the start out
+    }
+    close(fd);
+}
+
+// For clients; returns a connected socket or -1
+int notifyConnect(const char *name)
+{
+    struct sockaddr_un address;
+    socklen_t length;
+    int fd;
+
+    if ((length = socketAddress(&address, name)) == 0) {
+        return -1;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &address, length) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,51 @@
+/***************************************************
+ Filename: notify.h
+
+ Mode change notifications. The driver listens on
+ an abstract Unix socket and writes a line to every
+ connected client, and to any --mode-fd, whenever
+ the mode changes:
+
+     mode <number> <name>\n
+
+ A socket client first gets the driver's hello
+ line, then the current mode.
+ Clients may send commands back, one per line:
+
+     mode <number>\n
+
+ Only root, the driver's own user and members of
+ NOTIFY_GROUP may connect; the abstract namespace has
+ no file permissions, so the driver checks each
+ client's credentials itself.
+
+ Under systemd the mode also shows as the
+ service status, next to the READY=1 and STOPPING=1
+ notifications.
+ ***************************************************/
+
+#ifndef notify_h
+#define notify_h
+
+#define NOTIFY_SOCKET   "ti83keypad-mode" // Abstract socket name
+#define NOTIFY_GROUP    "ti83keypad" // Clients must be in it, unless root
+#define NOTIFY_CLIENTS  8
+#define NOTIFY_MODES    6 // Indexed by MODE_*, 0 unused
+#define NOTIFY_LINE     128 // Longest line either way
+
+typedef void (*NotifyCommand)(int fd, const char *command);
+
+extern const char *notifyModeNames[NOTIFY_MODES];
+extern const char *notifyModeIcons[NOTIFY_MODES];
+
+int notifyListen(const char *name, int mode);
+void notifyAccept(int listenFd);
+int notifyAddFd(int fd);
+void notifySetHello(const char *line);
+void notifySetCommands(NotifyCommand handler);
+int notifyReply(int fd, const char *line);
+void notifyMode(int mode);
+void notifySystemd(const char *state);
+int notifyConnect(const char *name);
+
+#endif /* notify_h */
@@ -0,0 +1,351 @@
+/***************************************************
+ Filename: output.c
+
+***************************************************/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#ifdef USE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xtest.h>
+#endif
+#include "output.h"
+
+unsigned long outputKeyEvents = 0;
+unsigned long outputFlushes = 0;
+static unsigned long pendingKeyEvents = 0;
+
+/*
+ * Xlib XTest Output
+ *
+ * XTestFakeKeyEvent only fills Xlib's request buffer, so a whole batch
+ * goes out in a single write on XFlush.
+ */
+
+static Display *xlibDisplay;
+
+static int xlibSetup(Display *display)
+{
+    int eventBase, errorBase, major, minor;
+
+    xlibDisplay = display;
+    return XTestQueryExtension(display, &eventBase, &errorBase, &major, &minor) ? 0 : -1;
+}
+
+// Symbols that only live on the shifted level of their key need a Shift
+static KeyCode xlibResolve(KeySym keySym, unsigned char *modifiers)
+{
+    KeyCode keycode = XKeysymToKeycode(xlibDisplay, keySym);
+
+    *modifiers = 0;
+    if (keycode != 0 &&
+        XkbKeycodeToKeysym(xlibDisplay, keycode, 0, 0) != keySym &&
+        XkbKeycodeToKeysym(xlibDisplay, keycode, 0, 1) == keySym) {
+        *modifiers = ShiftMask;
+    }
+
+    return keycode;
+}
+
+static void xlibSendKey(KeyCode keycode, Bool isPress)
+{
+    XTestFakeKeyEvent(xlibDisplay, keycode, isPress, 0);
+    pendingKeyEvents++;
+}
+
+// XTest delays the event in the server, so a paced macro costs no waiting here
+static void xlibSendKeyAfter(KeyCode keycode, Bool isPress, unsigned long delay)
+{
+    XTestFakeKeyEvent(xlibDisplay, keycode, isPress, delay);
+    pendingKeyEvents++;
+}
+
+static void xlibFlush(void)
+{
+    if (pendingKeyEvents == 0) {
+        return;
+    }
+    XFlush(xlibDisplay);
+    outputKeyEvents += pendingKeyEvents;
+    outputFlushes++;
+    pendingKeyEvents = 0;
+}
+
+const OutputBackend xlibOutput = {
+    "xlib",
+    True,
+    xlibSetup,
+    xlibResolve,
+    xlibSendKey,
+    xlibFlush,
+    xlibSendKeyAfter
+};
+
+#ifdef USE_XCB
+/*
+ * XCB XTest Output
+ *
+ * Uses unchecked requests on the display's own XCB connection, so
+ * requests are pipelined without ever waiting for a reply.
+ */
+
+static xcb_connection_t *connection;
+static xcb_window_t root;
+
+static int xcbSetup(Display *display)
+{
+    const xcb_query_extension_reply_t *extension;
+
+    xlibDisplay = display;
+    connection = XGetXCBConnection(display);
+    root = DefaultRootWindow(display);
+    extension = xcb_get_extension_data(connection, &xcb_test_id);
+
+    return (extension && extension->present) ? 0 : -1;
+}
+
+static void xcbSendKey(KeyCode keycode, Bool isPress)
+{
+    xcb_test_fake_input(connection, isPress ? XCB_KEY_PRESS : XCB_KEY_RELEASE,
+                        keycode, XCB_CURRENT_TIME, root, 0, 0, 0);
+    pendingKeyEvents++;
+}
+
+static void xcbSendKeyAfter(KeyCode keycode, Bool isPress, unsigned long delay)
+{
+    xcb_test_fake_input(connection, isPress ? XCB_KEY_PRESS : XCB_KEY_RELEASE,
+                        keycode, delay, root, 0, 0, 0);
+    pendingKeyEvents++;
+}
+
+static void xcbFlush(void)
+{
+    if (pendingKeyEvents == 0) {
+        return;
+    }
+    xcb_flush(connection);
+    outputKeyEvents += pendingKeyEvents;
+    outputFlushes++;
+    pendingKeyEvents = 0;
+}
+
+const OutputBackend xcbOutput = {
+    "xcb",
+    True,
+    xcbSetup,
+    xlibResolve,
+    xcbSendKey,
+    xcbFlush,
+    xcbSendKeyAfter
+};
+#endif
+
+/*
+ * uinput Output
+ *
+ * A virtual keyboard that needs no X server. KeySyms map to evdev codes
+ * through a US layout table; each key transition is its own SYN_REPORT
+ * frame, and a batch is written with a single write().
+ */
+
+typedef struct {
+    KeySym keySym;
+    unsigned short code;
+    unsigned char shift;
+} EvdevKey;
+
+static const EvdevKey evdevKeys[] = {
+    {XK_Escape, KEY_ESC, 0}, {XK_Tab, KEY_TAB, 0}, {XK_BackSpace, KEY_BACKSPACE, 0},
+    {XK_Delete, KEY_DELETE, 0}, {XK_Insert, KEY_INSERT, 0}, {XK_space, KEY_SPACE, 0},
+    {XK_Home, KEY_HOME, 0}, {XK_End, KEY_END, 0}, {XK_Page_Up, KEY_PAGEUP, 0}, {XK_Page_Down, KEY_PAGEDOWN, 0},
+    {XK_Up, KEY_UP, 0}, {XK_Down, KEY_DOWN, 0}, {XK_Left, KEY_LEFT, 0}, {XK_Right, KEY_RIGHT, 0},
+    {XK_Print, KEY_SYSRQ, 0}, {XK_Scroll_Lock, KEY_SCROLLLOCK, 0}, {XK_Pause, KEY_PAUSE, 0},
+    {XK_Num_Lock, KEY_NUMLOCK, 0}, {XK_Shift_L, KEY_LEFTSHIFT, 0}, {XK_Control_L, KEY_LEFTCTRL, 0},
+    {XK_F1, KEY_F1, 0}, {XK_F2, KEY_F2, 0}, {XK_F3, KEY_F3, 0}, {XK_F4, KEY_F4, 0},
+    {XK_F5, KEY_F5, 0}, {XK_F6, KEY_F6, 0}, {XK_F7, KEY_F7, 0}, {XK_F8, KEY_F8, 0},
+    {XK_F9, KEY_F9, 0}, {XK_F10, KEY_F10, 0}, {XK_F11, KEY_F11, 0}, {XK_F12, KEY_F12, 0},
+    {XK_KP_Multiply, KEY_KPASTERISK, 0}, {XK_KP_Subtract, KEY_KPMINUS, 0},
+    {XK_KP_Add, KEY_KPPLUS, 0}, {XK_KP_Enter, KEY_KPENTER, 0},
+    {XK_1, KEY_1, 0}, {XK_2, KEY_2, 0}, {XK_3, KEY_3, 0}, {XK_4, KEY_4, 0}, {XK_5, KEY_5, 0},
+    {XK_6, KEY_6, 0}, {XK_7, KEY_7, 0}, {XK_8, KEY_8, 0}, {XK_9, KEY_9, 0}, {XK_0, KEY_0, 0},
+    {XK_exclam, KEY_1, 1}, {XK_at, KEY_2, 1}, {XK_numbersign, KEY_3, 1}, {XK_dollar, KEY_4, 1},
+    {XK_percent, KEY_5, 1}, {XK_asciicircum, KEY_6, 1}, {XK_ampersand, KEY_7, 1},
+    {XK_asterisk, KEY_8, 1}, {XK_parenleft, KEY_9, 1}, {XK_parenright, KEY_0, 1},
+    {XK_minus, KEY_MINUS, 0}, {XK_underscore, KEY_MINUS, 1}, {XK_equal, KEY_EQUAL, 0}, {XK_plus, KEY_EQUAL, 1},
+    {XK_bracketleft, KEY_LEFTBRACE, 0}, {XK_braceleft, KEY_LEFTBRACE, 1},
+    {XK_bracketright, KEY_RIGHTBRACE, 0}, {XK_braceright, KEY_RIGHTBRACE, 1},
+    {XK_backslash, KEY_BACKSLASH, 0}, {XK_bar, KEY_BACKSLASH, 1},
+    {XK_semicolon, KEY_SEMICOLON, 0}, {XK_colon, KEY_SEMICOLON, 1},
+    {XK_apostrophe, KEY_APOSTROPHE, 0}, {XK_quotedbl, KEY_APOSTROPHE, 1},
+    {XK_grave, KEY_GRAVE, 0}, {XK_asciitilde, KEY_GRAVE, 1},
+    {XK_comma, KEY_COMMA, 0}, {XK_less, KEY_COMMA, 1}, {XK_period, KEY_DOT, 0}, {XK_greater, KEY_DOT, 1},
+    {XK_slash, KEY_SLASH, 0}, {XK_question, KEY_SLASH, 1},
+    {XK_a, KEY_A, 0}, {XK_b, KEY_B, 0}, {XK_c, KEY_C, 0}, {XK_d, KEY_D, 0}, {XK_e, KEY_E, 0},
+    {XK_f, KEY_F, 0}, {XK_g, KEY_G, 0}, {XK_h, KEY_H, 0}, {XK_i, KEY_I, 0}, {XK_j, KEY_J, 0},
+    {XK_k, KEY_K, 0}, {XK_l, KEY_L, 0}, {XK_m, KEY_M, 0}, {XK_n, KEY_N, 0}, {XK_o, KEY_O, 0},
+    {XK_p, KEY_P, 0}, {XK_q, KEY_Q, 0}, {XK_r, KEY_R, 0}, {XK_s, KEY_S, 0}, {XK_t, KEY_T, 0},
+    {XK_u, KEY_U, 0}, {XK_v, KEY_V, 0}, {XK_w, KEY_W, 0}, {XK_x, KEY_X, 0}, {XK_y, KEY_Y, 0},
+    {XK_z, KEY_Z, 0},
+    {XK_A, KEY_A, 1}, {XK_B, KEY_B, 1}, {XK_C, KEY_C, 1}, {XK_D, KEY_D, 1}, {XK_E, KEY_E, 1},
+    {XK_F, KEY_F, 1}, {XK_G, KEY_G, 1}, {XK_H, KEY_H, 1}, {XK_I, KEY_I, 1}, {XK_J, KEY_J, 1},
+    {XK_K, KEY_K, 1}, {XK_L, KEY_L, 1}, {XK_M, KEY_M, 1}, {XK_N, KEY_N, 1}, {XK_O, KEY_O, 1},
+    {XK_P, KEY_P, 1}, {XK_Q, KEY_Q, 1}, {XK_R, KEY_R, 1}, {XK_S, KEY_S, 1}, {XK_T, KEY_T, 1},
+    {XK_U, KEY_U, 1}, {XK_V, KEY_V, 1}, {XK_W, KEY_W, 1}, {XK_X, KEY_X, 1}, {XK_Y, KEY_Y, 1},
+    {XK_Z, KEY_Z, 1}
+};
+
+#define UINPUT_BATCH_SIZE 64
+
+static const char *uinputSinkPath = NULL;
+static int uinputFd = -1;
+static struct input_event uinputBatch[UINPUT_BATCH_SIZE];
+static int uinputBatchCount = 0;
+
+void uinputSetSink(const char *path)
+{
+    uinputSinkPath = path;
+}
+
+static int uinputSetup(Display *display)
+{
+    struct uinput_setup device;
+    unsigned int i;
+
+    if (uinputFd != -1) {
+        return 0;
+    }
+
+    if (uinputSinkPath) {
+        uinputFd = open(uinputSinkPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return (uinputFd == -1) ? -1 : 0;
+    }
+
+    if ((uinputFd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+        return -1;
+    }
+
+    ioctl(uinputFd, UI_SET_EVBIT, EV_KEY);
+    ioctl(uinputFd, UI_SET_EVBIT, EV_SYN);
+    for (i = 0; i < sizeof(evdevKeys) / sizeof(evdevKeys[0]); i++) {
+        ioctl(uinputFd, UI_SET_KEYBIT, evdevKeys[i].code);
+    }
+
+    memset(&device, 0, sizeof(device));
+    device.id.bustype = BUS_VIRTUAL;
+    device.id.vendor = 0x7183;
+    device.id.product = 0x0083;
+    strcpy(device.name, "TI-83 Keypad");
+
+    if (ioctl(uinputFd, UI_DEV_SETUP, &device) == -1 || ioctl(uinputFd, UI_DEV_CREATE) == -1) {
+        close(uinputFd);
+        uinputFd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Only used while building the key table, never per event
+static KeyCode uinputResolve(KeySym keySym, unsigned char *modifiers)
+{
+    unsigned int i;
+
+    *modifiers = 0;
+    for (i = 0; i < sizeof(evdevKeys) / sizeof(evdevKeys[0]); i++) {
+        if (evdevKeys[i].keySym == keySym) {
+            *modifiers = evdevKeys[i].shift ? ShiftMask : 0;
+            return evdevKeys[i].code;
+        }
+    }
+
+    return 0;
+}
+
+static void uinputFlush(void)
+{
+    ssize_t size = uinputBatchCount * sizeof(struct input_event);
+
+    if (uinputBatchCount == 0) {
+        return;
+    }
+    if (write(uinputFd, uinputBatch, size) != size) {
+        // The device went away, nothing sensible to do but drop the batch
+    }
+    outputKeyEvents += pendingKeyEvents;
+    outputFlushes++;
+    pendingKeyEvents = 0;
+    uinputBatchCount = 0;
+}
+
+static void uinputQueue(unsigned short type, unsigned short code, int value)
+{
+    struct input_event *event = &uinputBatch[uinputBatchCount++];
+
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+    event->code = code;
+    event->value = value;
+}
+
+static void uinputSendKey(KeyCode keycode, Bool isPress)
+{
+    if (uinputBatchCount + 2 > UINPUT_BATCH_SIZE) {
+        uinputFlush();
+    }
+    uinputQueue(EV_KEY, keycode, isPress ? 1 : 0);
+    uinputQueue(EV_SYN, SYN_REPORT, 0);
+    pendingKeyEvents++;
+}
+
+const OutputBackend uinputOutput = {
+    "uinput",
+    False,
+    uinputSetup,
+    uinputResolve,
+    uinputSendKey,
+    uinputFlush,
+    NULL
+};
+
+/*
+ * Counting Output
+ *
+ * Resolves like uinput but sends nothing, so benchmarks measure the
+ * driver rather than the target.
+ */
+
+static int countingSetup(Display *display)
+{
+    return 0;
+}
+
+static void countingSendKey(KeyCode keycode, Bool isPress)
+{
+    pendingKeyEvents++;
+}
+
+static void countingFlush(void)
+{
+    if (pendingKeyEvents == 0) {
+        return;
+    }
+    outputKeyEvents += pendingKeyEvents;
+    outputFlushes++;
+    pendingKeyEvents = 0;
+}
+
+const OutputBackend countingOutput = {
+    "counting",
+    False,
+    countingSetup,
+    uinputResolve,
+    countingSendKey,
+    countingFlush,
+    NULL
+};
@@ -0,0 +1,41 @@
+/***************************************************
+ Filename: output.h
+
+ Output backends inject key events. Events are only
+ queued by sendKey(); nothing reaches the target
+ until flush(), which is called once per batch of
+ scanner events. Keycodes are in the backend's own
+ space, as handed out by its resolve(). Backends
+ that can hold an event back on the target's side
+ provide sendKeyAfter(); it is NULL otherwise.
+ ***************************************************/
+
+#ifndef output_h
+#define output_h
+
+#include <X11/Xlib.h>
+
+typedef struct {
+    const char *name;
+    int needsDisplay;
+    int (*setup)(Display *display);         // Returns -1 on failure
+    KeyCode (*resolve)(KeySym keySym, unsigned char *modifiers); // 0 if keySym can't be typed
+    void (*sendKey)(KeyCode keycode, Bool isPress);
+    void (*flush)(void);
+    void (*sendKeyAfter)(KeyCode keycode, Bool isPress, unsigned long delay); // Milliseconds after the last event
+} OutputBackend;
+
+extern const OutputBackend xlibOutput;
+#ifdef USE_XCB
+extern const OutputBackend xcbOutput;
+#endif
+extern const OutputBackend uinputOutput;
+extern const OutputBackend countingOutput; // Only counts, for benchmarks
+
+// Write uinput events to path instead of creating a device, for systems without /dev/uinput
+void uinputSetSink(const char *path);
+
+extern unsigned long outputKeyEvents;
+extern unsigned long outputFlushes;
+
+#endif /* output_h */
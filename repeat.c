@@ -0,0 +1,85 @@
+/***************************************************
+ Filename: repeat.c
+
+***************************************************/
+
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "repeat.h"
+
+static int timerFd = -1;
+static RepeatSetting current;
+static unsigned int repeatKeycode = 0; // 0 when nothing is repeating
+static int repeatKey; // Which physical key is repeating, as the owner numbers them
+static unsigned int nextInterval;
+
+static void armTimer(unsigned int milliseconds)
+{
+    struct itimerspec timer = {{0, 0}, {0, 0}};
+
+    timer.it_value.tv_sec = milliseconds / 1000;
+    timer.it_value.tv_nsec = (milliseconds % 1000) * 1000000L;
+    timerfd_settime(timerFd, 0, &timer, NULL);
+}
+
+int repeatInit(void)
+{
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return (timerFd == -1) ? -1 : 0;
+}
+
+int repeatFd(void)
+{
+    return timerFd;
+}
+
+// A new key takes over from whatever was repeating
+void repeatStart(const RepeatSetting *setting, unsigned int keycode, int key)
+{
+    if (timerFd == -1 || setting->delay == 0 || keycode == 0) {
+        repeatCancel();
+        return;
+    }
+
+    current = *setting;
+    repeatKeycode = keycode;
+    repeatKey = key;
+    nextInterval = setting->interval;
+    armTimer(setting->delay);
+}
+
+void repeatStop(int key)
+{
+    if (repeatKeycode != 0 && key == repeatKey) {
+        repeatCancel();
+    }
+}
+
+void repeatCancel(void)
+{
+    if (repeatKeycode != 0) {
+        repeatKeycode = 0;
+        armTimer(0);
+    }
+}
+
+// Returns the keycode due for a repeat, or 0, and schedules the next one
+unsigned int repeatExpired(void)
+{
+    uint64_t expirations;
+
+    if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations) || repeatKeycode == 0) {
+        return 0;
+    }
+
+    armTimer(nextInterval);
+    nextInterval = nextInterval * current.acceleration / 100;
+    if (nextInterval < current.minInterval) {
+        nextInterval = current.minInterval;
+    }
+    if (nextInterval == 0) {
+        nextInterval = 1; // A zero timer would disarm
+    }
+
+    return repeatKeycode;
+}
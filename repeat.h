@@ -0,0 +1,31 @@
+/***************************************************
+ Filename: repeat.h
+
+ Typematic autorepeat. The most recently pressed key
+ repeats after its delay, then at an interval that
+ shrinks by the acceleration factor on every repeat
+ down to a minimum. Timing comes from a timerfd, so
+ nothing polls; the owner watches repeatFd() and
+ calls repeatExpired() when it becomes readable.
+ ***************************************************/
+
+#ifndef repeat_h
+#define repeat_h
+
+#include <stdint.h>
+
+typedef struct {
+    uint16_t delay;         // Milliseconds before the first repeat, 0 to never repeat
+    uint16_t interval;      // Milliseconds between the first repeats
+    uint16_t minInterval;   // Fastest the interval may accelerate to
+    uint8_t acceleration;   // Each interval as a percentage of the one before
+} RepeatSetting;
+
+int repeatInit(void);
+int repeatFd(void);
+void repeatStart(const RepeatSetting *setting, unsigned int keycode, int key);
+void repeatStop(int key);
+void repeatCancel(void);
+unsigned int repeatExpired(void);
+
+#endif /* repeat_h */
@@ -0,0 +1,397 @@
+/***************************************************
+ Filename: scanner.c
+
+***************************************************/
+
+#define _GNU_SOURCE // pthread_attr_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <wiringPi.h>
+#include "scanner.h"
+#include "stats.h"
+
+const uint32_t scanTiers[SCAN_TIERS] = { 1000, 2000, 5000, 10000 };
+
+_Static_assert(SCAN_TIERS <= STATS_TIERS, "Stats has no room for every scan tier");
+_Static_assert(MATRIX_MAX <= STATS_KEYPADS, "Stats has no room for every keypad");
+
+// The statistics slot of the scanner's keypad, which sets up its matrix in the same order
+static inline KeypadStats *keypadStats(const Scanner *scanner)
+{
+    return &stats->keypads[scanner->matrix->index];
+}
+
+// Enough samples to span the time; the first sample starts it
+static int ticksFor(int milliseconds, uint32_t period)
+{
+    return (milliseconds * 1000 + period - 1) / period + 1;
+}
+
+static void setTier(Scanner *scanner, int newTier)
+{
+    if (scanner->tier >= 0 && newTier != scanner->tier) {
+        statsCount(&keypadStats(scanner)->rateChanges);
+    }
+    scanner->tier = newTier;
+    debounceSetTicks(&scanner->debouncer, ticksFor(scanner->debouncePressTime, scanTiers[newTier]),
+                     ticksFor(scanner->debounceReleaseTime, scanTiers[newTier]));
+    atomic_store_explicit(&keypadStats(scanner)->scanPeriod, scanTiers[newTier], memory_order_relaxed);
+}
+
+static void pushEvent(Scanner *scanner, int type, int row, int col, uint64_t detected, uint64_t accepted)
+{
+    KeyEvent event;
+    uint64_t one = 1;
+
+    event.timestamp = accepted;
+    event.detected = detected;
+    event.type = type;
+    event.row = row;
+    event.col = col;
+
+    if (!keyQueuePush(scanner->queue, &event)) {
+        statsCount(&keypadStats(scanner)->eventsDropped);
+        return;
+    }
+    statsCount(&keypadStats(scanner)->eventsQueued);
+    if (type != EVENT_CHORD) {
+        histogramRecord(&keypadStats(scanner)->detectToAccept, event.timestamp - detected);
+    }
+
+    if (scanner->notifyFd != -1 && write(scanner->notifyFd, &one, sizeof(one)) != sizeof(one)) {
+        // The eventfd counter only fails on overflow, and the consumer will still drain the queue
+    }
+}
+
+// Without diodes, three keys on the corners of a rectangle make the fourth
+// corner read as pressed too. Any two rows that share two or more columns
+// are ambiguous at those columns, so those keys keep their previous state
+// until the pattern resolves.
+static void maskGhosts(uint8_t *snapshot, const uint8_t *previous, int rows)
+{
+    int a, b;
+    uint8_t shared;
+    uint8_t ghosts[ROW_COUNT] = {0};
+
+    for (a = 0; a < rows; a++) {
+        for (b = a + 1; b < rows; b++) {
+            shared = snapshot[a] & snapshot[b];
+            if (shared & (shared - 1)) { // Two or more bits
+                ghosts[a] |= shared;
+                ghosts[b] |= shared;
+            }
+        }
+    }
+
+    for (a = 0; a < rows; a++) {
+        snapshot[a] = (snapshot[a] & ~ghosts[a]) | (previous[a] & ghosts[a]);
+    }
+}
+
+// Sample the whole matrix and report every key whose debounced state changed.
+// Returns whether any key is in motion.
+static int scanMatrix(Scanner *scanner, uint64_t scanStart)
+{
+    GpioMatrix *matrix = scanner->matrix;
+    const GpioBackend *gpio = matrix->backend;
+    Debouncer *debouncer = &scanner->debouncer;
+    uint8_t snapshot[DEBOUNCE_ROWS] = {0};
+    uint8_t changed[DEBOUNCE_ROWS];
+    uint8_t wasPending[DEBOUNCE_ROWS];
+    uint8_t started;
+    uint8_t *keyState = debouncer->state;
+    uint8_t chords[CHORD_MAX];
+    uint8_t moving = 0;
+    int row, col, i, fired;
+
+    for (row = 0; row < matrix->pins.rows; row++) {
+        gpio->selectRows(matrix, 1 << row);
+        snapshot[row] = gpio->readColumns(matrix);
+    }
+    snapshot[ONKEY_ROW] = (gpio->readOnKey(matrix) == LOW) ? 1 : 0;
+
+    if (scanner->recording) {
+        traceWriterScan(&scanner->recorder, scanStart, snapshot);
+    }
+
+    maskGhosts(snapshot, keyState, matrix->pins.rows);
+
+    for (row = 0; row <= ONKEY_ROW; row++) {
+        wasPending[row] = debouncer->pending[row];
+    }
+    debounceUpdate(debouncer, snapshot, changed);
+
+    for (row = 0; row <= ONKEY_ROW; row++) {
+        moving |= debouncer->pending[row] | changed[row];
+
+        // Keys that started changing on this scan
+        started = (debouncer->pending[row] | changed[row]) & ~wasPending[row];
+        while (started) {
+            col = __builtin_ctz(started);
+            started &= started - 1;
+            scanner->firstSeen[row][col] = scanStart;
+        }
+
+        while (changed[row]) {
+            col = __builtin_ctz(changed[row]);
+            changed[row] &= changed[row] - 1;
+            pushEvent(scanner, (keyState[row] & (1 << col)) ? EVENT_PRESS : EVENT_RELEASE, row, col,
+                      scanner->firstSeen[row][col], scanStart);
+        }
+    }
+
+    // Chords follow the key events that completed them
+    fired = chordUpdate(&scanner->chordEngine, keyState, scanStart, chords);
+    for (i = 0; i < fired; i++) {
+        pushEvent(scanner, EVENT_CHORD, scanner->chordTable[chords[i]].action, chords[i], scanStart, scanStart);
+    }
+
+    return moving != 0;
+}
+
+// Touch the stack the scan loop will use, so a locked process never
+// page faults on it mid-scan
+static void prefaultStack(void)
+{
+    char stack[SCAN_STACK_PREFAULT];
+
+    memset(stack, 0, sizeof(stack));
+    __asm__ volatile ("" : : "r" (stack) : "memory"); // Keep the writes
+}
+
+// Drive every row so that any key shows up on its column, then sleep until
+// an edge. Returns -1 if the backend can't wait for edges.
+static int waitForActivity(Scanner *scanner)
+{
+    GpioMatrix *matrix = scanner->matrix;
+
+    matrix->backend->selectRows(matrix, (1 << matrix->pins.rows) - 1);
+    return matrix->backend->waitForEdge(matrix, scanner->stopFd);
+}
+
+static void *scanLoop(void *data)
+{
+    Scanner *scanner = data;
+    int edgesAvailable = 1;
+    uint64_t scanStart, period;
+    uint64_t quietSince = 0;
+    uint64_t deadline = monotonicNanos();
+    struct timespec wakeAt;
+
+    prefaultStack();
+
+    while (atomic_load(&scanner->running)) {
+        scanStart = monotonicNanos();
+        // A whole period late means a scan was skipped
+        if (scanStart > deadline + scanTiers[scanner->tier] * 1000ull) {
+            statsCount(&keypadStats(scanner)->missedDeadlines);
+            deadline = scanStart;
+        }
+
+        period = scannerScanOnce(scanner, scanStart);
+
+        if (!debounceIsIdle(&scanner->debouncer)) {
+            quietSince = 0;
+        } else if (quietSince == 0) {
+            quietSince = scanStart;
+        }
+
+        if (edgesAvailable && quietSince && scanStart - quietSince >= IDLE_DELAY * 1000000ull) {
+            quietSince = 0;
+            atomic_store_explicit(&keypadStats(scanner)->scanPeriod, 0, memory_order_relaxed);
+            if (waitForActivity(scanner) == -1) {
+                edgesAvailable = 0;
+            } else if (scanner->pinnedTier < 0) {
+                // An edge is activity; catch it at full rate
+                scanner->lastActivity = monotonicNanos();
+                setTier(scanner, 0);
+            }
+            setTier(scanner, scanner->tier);
+            deadline = monotonicNanos();
+            continue;
+        }
+
+        // Absolute deadlines, so time spent scanning doesn't stretch the period
+        deadline += period;
+        wakeAt.tv_sec = deadline / 1000000000ull;
+        wakeAt.tv_nsec = deadline % 1000000000ull;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeAt, NULL) == EINTR);
+        histogramRecord(&keypadStats(scanner)->scanJitter, monotonicNanos() - deadline);
+    }
+    return NULL;
+}
+
+// Settings every scanner starts from
+void scannerDefaults(Scanner *scanner)
+{
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->debouncePressTime = DEBOUNCE_PRESS_TIME;
+    scanner->debounceReleaseTime = DEBOUNCE_RELEASE_TIME;
+    scanner->pinnedTier = -1;
+    scanner->realtimeCpu = -1;
+    scanner->notifyFd = -1;
+    scanner->stopFd = -1;
+    scanner->tier = SCAN_TIERS - 1;
+}
+
+void scannerInit(Scanner *scanner, GpioMatrix *matrix, KeyQueue *eventQueue, int eventFd)
+{
+    int i;
+
+    scanner->matrix = matrix;
+    scanner->queue = eventQueue;
+    scanner->notifyFd = eventFd;
+    debounceInit(&scanner->debouncer, 1, 1);
+    chordInit(&scanner->chordEngine, scanner->chordTable, scanner->chordCount);
+    for (i = 0; i < SCAN_TIERS; i++) {
+        atomic_store(&stats->tierPeriods[i], scanTiers[i]);
+    }
+    scanner->tier = -1;
+    setTier(scanner, (scanner->pinnedTier >= 0) ? scanner->pinnedTier : SCAN_TIERS - 1);
+    scanner->lastActivity = 0;
+}
+
+// One pass over the matrix, timestamped with now. Returns the period, in
+// nanoseconds, until the next scan is due. The scanner thread calls this
+// on its own schedule; simulations can call it directly on their own clock.
+uint64_t scannerScanOnce(Scanner *scanner, uint64_t now)
+{
+    uint64_t started = monotonicNanos();
+    int tier = scanner->tier;
+
+    if (scanMatrix(scanner, now)) {
+        scanner->lastActivity = now;
+    }
+    statsCount(&keypadStats(scanner)->scans);
+    statsCount(&keypadStats(scanner)->tierScans[tier]);
+    histogramRecord(&keypadStats(scanner)->scanDuration, monotonicNanos() - started);
+
+    if (scanner->pinnedTier < 0) {
+        if (scanner->lastActivity == now && tier != 0) {
+            setTier(scanner, 0);
+        } else if (tier < SCAN_TIERS - 1 && now - scanner->lastActivity >= (tier + 1) * SCAN_TIER_HOLD * 1000000ull) {
+            setTier(scanner, tier + 1);
+        }
+    }
+
+    return scanTiers[scanner->tier] * 1000ull;
+}
+
+static int createScanThread(Scanner *scanner, int priority, int cpu)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    cpu_set_t cpus;
+    int result;
+
+    pthread_attr_init(&attr);
+    // A small stack, since mlockall() locks the whole of it
+    pthread_attr_setstacksize(&attr, SCAN_STACK_SIZE);
+    if (priority > 0) {
+        param.sched_priority = priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    if (cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    result = pthread_create(&scanner->thread, &attr, scanLoop, scanner);
+    pthread_attr_destroy(&attr);
+    return result;
+}
+
+int scannerStart(Scanner *scanner, GpioMatrix *matrix, KeyQueue *eventQueue, int eventFd)
+{
+    scannerInit(scanner, matrix, eventQueue, eventFd);
+    if ((scanner->stopFd = eventfd(0, EFD_NONBLOCK)) == -1) {
+        return -1;
+    }
+    atomic_store(&scanner->running, 1);
+
+    // Fall back to a normal thread without the privileges or the CPU for real-time
+    scanner->realtimeActive = (scanner->realtimePriority > 0 || scanner->realtimeCpu >= 0);
+    if (!scanner->realtimeActive ||
+        createScanThread(scanner, scanner->realtimePriority, scanner->realtimeCpu) != 0) {
+        scanner->realtimeActive = 0;
+        if (createScanThread(scanner, 0, -1) != 0) {
+            atomic_store(&scanner->running, 0);
+            close(scanner->stopFd);
+            scanner->stopFd = -1;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Whether scannerStart() got the scheduling asked for with scannerSetRealtime()
+int scannerIsRealtime(const Scanner *scanner)
+{
+    return scanner->realtimeActive;
+}
+
+void scannerStop(Scanner *scanner)
+{
+    uint64_t one = 1;
+
+    if (atomic_exchange(&scanner->running, 0)) {
+        if (write(scanner->stopFd, &one, sizeof(one)) != sizeof(one)) {
+            // Already signalled
+        }
+        pthread_join(scanner->thread, NULL);
+        close(scanner->stopFd);
+        scanner->stopFd = -1;
+    }
+
+    if (scanner->recording) {
+        traceWriterClose(&scanner->recorder);
+        scanner->recording = 0;
+    }
+}
+
+// Record every raw matrix sample to path. Must be called before scannerStart().
+int scannerRecord(Scanner *scanner, const char *path)
+{
+    if (traceWriterOpen(&scanner->recorder, path, monotonicNanos()) == -1) {
+        return -1;
+    }
+    scanner->recording = 1;
+    return 0;
+}
+
+// Must be called before scannerStart() or scannerInit()
+void scannerSetDebounce(Scanner *scanner, int pressMillis, int releaseMillis)
+{
+    scanner->debouncePressTime = pressMillis;
+    scanner->debounceReleaseTime = releaseMillis;
+}
+
+// Scan at a single tier instead of adapting, or adapt again with -1.
+// Must be called before scannerStart() or scannerInit().
+void scannerPinTier(Scanner *scanner, int pinned)
+{
+    scanner->pinnedTier = (pinned >= 0 && pinned < SCAN_TIERS) ? pinned : -1;
+}
+
+// Scan from a SCHED_FIFO thread at priority (0 for the normal scheduler),
+// pinned to cpu (-1 for any). Must be called before scannerStart().
+void scannerSetRealtime(Scanner *scanner, int priority, int cpu)
+{
+    scanner->realtimePriority = priority;
+    scanner->realtimeCpu = cpu;
+}
+
+// Must be called before scannerStart() or scannerInit()
+void scannerSetChords(Scanner *scanner, const Chord *chords, int count)
+{
+    scanner->chordTable = chords;
+    scanner->chordCount = count;
+}
@@ -0,0 +1,79 @@
+/***************************************************
+ Filename: scanner.h
+
+ Matrix scanner. Each Scanner samples one keypad
+ matrix from its own thread and pushes timestamped
+ events into that keypad's KeyQueue, signalling
+ notifyFd (an eventfd, which scanners may share) for
+ each. Without the thread, scannerInit() and
+ scannerScanOnce() scan on a caller's clock.
+
+ The scan rate adapts to activity: any key in motion
+ jumps to the fastest tier, and every SCAN_TIER_HOLD
+ of quiet steps down a tier. Debounce times are kept
+ in milliseconds, so they hold at every rate.
+
+ In real-time mode the thread runs SCHED_FIFO, can
+ be pinned to an isolated core, and its stack is
+ pre-faulted. Nothing on the scan path allocates or
+ logs; scan-period jitter goes to the statistics.
+ ***************************************************/
+
+#ifndef scanner_h
+#define scanner_h
+
+#include <pthread.h>
+#include "gpio.h"
+#include "keyqueue.h"
+#include "debounce.h"
+#include "chord.h"
+#include "tracefile.h"
+
+#define SCAN_TIERS      4
+#define SCAN_TIER_HOLD  100 // Quiet time in Milliseconds before stepping down a tier
+#define IDLE_DELAY      250 // Quiet time in Milliseconds before waiting for an edge
+#define SCAN_STACK_SIZE     (256 * 1024)
+#define SCAN_STACK_PREFAULT (64 * 1024) // Stack touched up front, within SCAN_STACK_SIZE
+
+extern const uint32_t scanTiers[SCAN_TIERS]; // Scan periods in microseconds, fastest first
+
+typedef struct {
+    // Settings, from scannerDefaults() and the scannerSet functions
+    int debouncePressTime;
+    int debounceReleaseTime;
+    int pinnedTier; // Or -1 to adapt
+    const Chord *chordTable;
+    int chordCount;
+    int realtimePriority; // SCHED_FIFO priority, or 0 for the normal scheduler
+    int realtimeCpu;
+    int recording;
+    TraceWriter recorder;
+
+    // Scanning state
+    GpioMatrix *matrix;
+    KeyQueue *queue;
+    int notifyFd;
+    int stopFd;
+    pthread_t thread;
+    atomic_int running;
+    int realtimeActive;
+    Debouncer debouncer;
+    int tier;
+    uint64_t lastActivity; // Last scan with a key in motion
+    ChordEngine chordEngine;
+    uint64_t firstSeen[DEBOUNCE_ROWS][8]; // When each pending key's raw state first changed
+} Scanner;
+
+void scannerDefaults(Scanner *scanner);
+void scannerInit(Scanner *scanner, GpioMatrix *matrix, KeyQueue *queue, int notifyFd);
+uint64_t scannerScanOnce(Scanner *scanner, uint64_t now);
+int scannerStart(Scanner *scanner, GpioMatrix *matrix, KeyQueue *queue, int notifyFd);
+void scannerStop(Scanner *scanner);
+void scannerSetDebounce(Scanner *scanner, int pressMillis, int releaseMillis);
+void scannerPinTier(Scanner *scanner, int tier);
+void scannerSetChords(Scanner *scanner, const Chord *chords, int count);
+void scannerSetRealtime(Scanner *scanner, int priority, int cpu);
+int scannerIsRealtime(const Scanner *scanner);
+int scannerRecord(Scanner *scanner, const char *path);
+
+#endif /* scanner_h */
@@ -0,0 +1,103 @@
+/***************************************************
+ Filename: simtrace.c
+
+***************************************************/
+
+#include <string.h>
+#include "simtrace.h"
+
+#define MILLIS  1000000ull
+
+static unsigned int nextRandom(unsigned int *state)
+{
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Random typing: strokes 10-70 ms apart, held 30-150 ms, so neighbours overlap.
+// A key is never reused until it has been released and settled.
+void simTraceGenerate(SimTrace *trace, SimKeystroke *strokes, int count, unsigned int seed)
+{
+    uint64_t keyFree[ROW_COUNT][COL_COUNT];
+    uint64_t now = 0;
+    unsigned int state = seed ? seed : 83;
+    SimKeystroke *stroke;
+    int i;
+
+    memset(keyFree, 0, sizeof(keyFree));
+    memset(trace, 0, sizeof(*trace));
+    trace->strokes = strokes;
+    trace->count = count;
+
+    for (i = 0; i < count; i++) {
+        stroke = &strokes[i];
+        now += (10 + nextRandom(&state) % 60) * MILLIS;
+        do {
+            stroke->row = nextRandom(&state) % ROW_COUNT;
+            stroke->col = nextRandom(&state) % COL_COUNT;
+        } while (keyFree[stroke->row][stroke->col] > now);
+
+        stroke->pressAt = now;
+        stroke->releaseAt = now + (30 + nextRandom(&state) % 120) * MILLIS;
+        stroke->bounce = (nextRandom(&state) % 6) * MILLIS;
+        keyFree[stroke->row][stroke->col] = stroke->releaseAt + stroke->bounce + 20 * MILLIS;
+    }
+}
+
+uint64_t simTraceEnd(const SimTrace *trace)
+{
+    int i;
+    uint64_t end = 0;
+
+    for (i = 0; i < trace->count; i++) {
+        if (trace->strokes[i].releaseAt + trace->strokes[i].bounce > end) {
+            end = trace->strokes[i].releaseAt + trace->strokes[i].bounce;
+        }
+    }
+    return end;
+}
+
+// Chatter is a fixed pseudo-random pattern per key and millisecond
+static int bounceContact(const SimKeystroke *stroke, uint64_t now)
+{
+    unsigned int state = (unsigned int) (now / MILLIS) * 2654435761u + stroke->row * 31 + stroke->col + 1;
+    return nextRandom(&state) & 1;
+}
+
+static int strokeContact(const SimKeystroke *stroke, uint64_t now)
+{
+    if (now < stroke->pressAt || now >= stroke->releaseAt + stroke->bounce) {
+        return 0;
+    }
+    if (now < stroke->pressAt + stroke->bounce || now >= stroke->releaseAt) {
+        return bounceContact(stroke, now);
+    }
+    return 1;
+}
+
+void simTraceApply(SimTrace *trace, GpioMatrix *matrix, uint64_t now)
+{
+    uint8_t rows[ROW_COUNT] = {0};
+    SimKeystroke *stroke;
+    int i;
+
+    while (trace->first < trace->count &&
+           trace->strokes[trace->first].releaseAt + trace->strokes[trace->first].bounce <= now) {
+        stroke = &trace->strokes[trace->first++];
+        trace->lastEdge[stroke->row][stroke->col] = stroke->releaseAt;
+    }
+
+    // Holds are short, so only a handful of strokes past first can be active
+    for (i = trace->first; i < trace->count && trace->strokes[i].pressAt <= now; i++) {
+        stroke = &trace->strokes[i];
+        trace->lastEdge[stroke->row][stroke->col] = (now < stroke->releaseAt) ? stroke->pressAt : stroke->releaseAt;
+        if (strokeContact(stroke, now)) {
+            rows[stroke->row] |= 1 << stroke->col;
+        }
+    }
+
+    simSetMatrix(matrix, rows, 0);
+}
@@ -0,0 +1,36 @@
+/***************************************************
+ Filename: simtrace.h
+
+ Scripted keystroke traces for the simulated GPIO
+ backend. A trace is a list of keystrokes on a
+ simulated clock; applying it at a given time sets
+ the simulated matrix to how the contacts would
+ read then, contact bounce included.
+ ***************************************************/
+
+#ifndef simtrace_h
+#define simtrace_h
+
+#include <stdint.h>
+#include "gpio.h"
+
+typedef struct {
+    uint64_t pressAt;   // Simulated nanoseconds
+    uint64_t releaseAt;
+    uint32_t bounce;    // Nanoseconds of contact chatter after each edge
+    uint8_t row;
+    uint8_t col;
+} SimKeystroke;
+
+typedef struct {
+    SimKeystroke *strokes; // Sorted by pressAt
+    int count;
+    int first;             // Strokes before this one are over
+    uint64_t lastEdge[ROW_COUNT][COL_COUNT]; // Latest press or release seen on each key
+} SimTrace;
+
+void simTraceGenerate(SimTrace *trace, SimKeystroke *strokes, int count, unsigned int seed);
+uint64_t simTraceEnd(const SimTrace *trace);
+void simTraceApply(SimTrace *trace, GpioMatrix *matrix, uint64_t now);
+
+#endif /* simtrace_h */
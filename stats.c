@@ -0,0 +1,85 @@
+/***************************************************
+ Filename: stats.c
+
+***************************************************/
+
+#include <string.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "keyqueue.h"
+#include "stats.h"
+
+// Stays valid even if shared memory is unavailable, so writers never need to check
+static Stats localStats;
+Stats *stats = &localStats;
+
+// A ti83stats still sampling a block left behind sees it go unrecognized
+static void retireStats(void)
+{
+    struct stat status;
+    Stats *old;
+    int fd;
+
+    if ((fd = shm_open(STATS_NAME, O_RDWR | O_CLOEXEC, 0)) == -1) {
+        return;
+    }
+    // Only a block the driver made; another user's object is just unlinked
+    if (fstat(fd, &status) == 0 && status.st_uid == geteuid() && status.st_size == sizeof(Stats)) {
+        old = mmap(NULL, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED) {
+            old->magic = 0;
+            munmap(old, sizeof(Stats));
+        }
+    }
+    close(fd);
+}
+
+int statsOpen(int keypadCount)
+{
+    struct group *readers = getgrnam(STATS_GROUP);
+    void *map;
+    int fd;
+
+    stats->magic = STATS_MAGIC;
+    stats->version = STATS_VERSION;
+    stats->startTime = monotonicNanos();
+    stats->keypadCount = keypadCount;
+
+    // Always a fresh block of our own, never one left behind or created first by someone else
+    retireStats();
+    shm_unlink(STATS_NAME);
+    if ((fd = shm_open(STATS_NAME, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, STATS_MODE)) == -1) {
+        return -1;
+    }
+    // Readable by root and STATS_GROUP only, whatever the umask
+    if ((readers != NULL && fchown(fd, -1, readers->gr_gid) == -1) ||
+        fchmod(fd, STATS_MODE) == -1 ||
+        ftruncate(fd, sizeof(Stats)) == -1) {
+        close(fd);
+        shm_unlink(STATS_NAME);
+        return -1;
+    }
+    map = mmap(NULL, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        shm_unlink(STATS_NAME);
+        return -1;
+    }
+
+    memcpy(map, &localStats, sizeof(Stats));
+    stats = map;
+    return 0;
+}
+
+void statsClose(void)
+{
+    if (stats != &localStats) {
+        munmap(stats, sizeof(Stats));
+        stats = &localStats;
+        shm_unlink(STATS_NAME);
+    }
+}
@@ -0,0 +1,135 @@
+/***************************************************
+ Filename: stats.h
+
+ Live driver statistics. The Stats block lives in a
+ POSIX shared memory object so that ti83stats can
+ read it while the driver runs. Like the key event
+ ring, it is readable only by root and by members of
+ STATS_GROUP. Each keypad's scanner thread has its
+ own KeypadStats slot, so updates are relaxed atomic
+ adds with no locks; the injection side runs on the
+ main thread and covers them all.
+ ***************************************************/
+
+#ifndef stats_h
+#define stats_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define STATS_NAME      "/ti83keypad-stats"
+#define STATS_GROUP     "ti83keypad" // Readers must be in it, as for the event ring
+#define STATS_MODE      0640
+#define STATS_MAGIC     0x54493833 // "TI83"
+#define STATS_VERSION   4
+#define STATS_TIERS     8 // Room for the scanner's rate tiers
+#define STATS_KEYPADS   4 // Room for MATRIX_MAX scanners
+
+// Log-linear (HDR style) buckets: exact below 8us, then 8 buckets per power of two
+#define HISTOGRAM_SUB_BITS  3
+#define HISTOGRAM_BUCKETS   (30 << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    atomic_ulong counts[HISTOGRAM_BUCKETS];
+    atomic_ulong samples;
+    atomic_ulong max; // In microseconds
+} Histogram;
+
+// One keypad's scanner thread
+typedef struct {
+    atomic_ulong scans;
+    atomic_ulong missedDeadlines;
+    atomic_ulong eventsQueued;
+    atomic_ulong eventsDropped;
+    Histogram scanDuration;
+    Histogram detectToAccept; // First raw change to debounce acceptance
+    atomic_ulong scanPeriod;  // Current, in microseconds; 0 while waiting for an edge
+    atomic_ulong rateChanges;
+    atomic_ulong tierScans[STATS_TIERS];
+    Histogram scanJitter; // How late the thread woke for each scan
+} KeypadStats;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t startTime; // CLOCK_MONOTONIC, in nanoseconds
+    uint32_t keypadCount;
+    atomic_ulong tierPeriods[STATS_TIERS]; // In microseconds, 0 past the last tier
+
+    // Scanner threads, by keypad
+    KeypadStats keypads[STATS_KEYPADS];
+
+    // Injection side
+    atomic_ulong eventsInjected;
+    atomic_ulong flushes;
+    Histogram acceptToInject;
+    Histogram detectToInject;
+} Stats;
+
+extern Stats *stats;
+
+int statsOpen(int keypadCount);
+void statsClose(void);
+
+static inline int histogramBucket(uint64_t micros)
+{
+    int shift;
+
+    if (micros < (1 << HISTOGRAM_SUB_BITS)) {
+        return micros;
+    }
+    if (micros >= (1ull << 31)) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    shift = (63 - __builtin_clzll(micros)) - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) + ((micros >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+// Smallest value, in microseconds, that lands in bucket
+static inline uint64_t histogramBucketValue(int bucket)
+{
+    int shift;
+
+    if (bucket < (1 << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+    shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    return (uint64_t) ((1 << HISTOGRAM_SUB_BITS) + (bucket & ((1 << HISTOGRAM_SUB_BITS) - 1))) << shift;
+}
+
+static inline void histogramRecord(Histogram *histogram, uint64_t nanos)
+{
+    uint64_t micros = nanos / 1000;
+    unsigned long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&histogram->counts[histogramBucket(micros)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->samples, 1, memory_order_relaxed);
+    while (micros > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, micros,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {
+        // Another scanner raised it first; max now holds its value
+    }
+}
+
+// Lower bound, in microseconds, of the value at fraction (0.0 - 1.0) of the samples
+static inline uint64_t histogramPercentile(const Histogram *histogram, double fraction)
+{
+    unsigned long samples = atomic_load(&histogram->samples);
+    unsigned long target = (unsigned long) (samples * fraction);
+    unsigned long seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += atomic_load(&histogram->counts[bucket]);
+        if (seen > target) {
+            return histogramBucketValue(bucket);
+        }
+    }
+    return atomic_load(&histogram->max);
+}
+
+static inline void statsCount(atomic_ulong *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+#endif /* stats_h */
@@ -0,0 +1,111 @@
+/***************************************************
+  Filename: ti83events.c
+
+  Follows the key event ring of a running
+  ti83keypad and prints every event, or with
+  "mode N [keypad]", asks the driver to change
+  the mode of the first or the given keypad.
+
+***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "keyqueue.h"
+#include "eventring.h"
+#include "notify.h"
+
+static const char *typeNames[] = { "?", "press", "release", "chord" };
+
+// Waits for the driver to announce the new mode, past the current one it sent on connecting.
+// Only the first keypad's mode is announced; other keypads are acknowledged with "ok".
+static int changeMode(int fd, int mode, int keypad)
+{
+    FILE *replies = fdopen(fd, "r+");
+    char line[NOTIFY_LINE];
+    int announced;
+
+    if (replies == NULL || fprintf(replies, "mode %d %d\n", mode, keypad) < 0 || fflush(replies) == EOF) {
+        fprintf(stderr, "Can't send the command\n");
+        return 1;
+    }
+    while (fgets(line, sizeof(line), replies) != NULL) {
+        if (strncmp(line, "error", 5) == 0) {
+            fprintf(stderr, "%s", line);
+            return 1;
+        }
+        if (keypad != 0 && strncmp(line, "ok", 2) == 0) {
+            return 0;
+        }
+        if (keypad == 0 && sscanf(line, "mode %d", &announced) == 1 && announced == mode) {
+            printf("%s", line);
+            return 0;
+        }
+    }
+    fprintf(stderr, "The driver closed the connection; only root and the %s group may use it\n", NOTIFY_GROUP);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char line[NOTIFY_LINE];
+    char name[NOTIFY_LINE];
+    const EventRing *ring;
+    RingEvent event;
+    uint32_t position, lost = 0, reported = 0;
+    unsigned int version, size;
+    ssize_t length;
+    int fd;
+
+    signal(SIGPIPE, SIG_IGN); // A refused connection is reported, not fatal
+    if ((fd = notifyConnect(NOTIFY_SOCKET)) == -1) {
+        fprintf(stderr, "ti83keypad doesn't appear to be running\n");
+        exit(1);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "mode") == 0) {
+        return changeMode(fd, atoi(argv[2]), (argc == 4) ? atoi(argv[3]) : 0);
+    }
+
+    if ((length = read(fd, line, sizeof(line) - 1)) <= 0) {
+        fprintf(stderr, "No greeting from the driver; only root and the %s group may use it\n", NOTIFY_GROUP);
+        exit(1);
+    }
+    line[length] = '\0';
+
+    if (sscanf(line, "events %127s %u %u", name, &version, &size) != 3 ||
+        version != EVENT_RING_VERSION || size != EVENT_RING_SIZE) {
+        fprintf(stderr, "Unrecognized greeting: %s", line);
+        exit(1);
+    }
+    if ((ring = eventRingAttach()) == NULL) {
+        fprintf(stderr, "Can't map the key event ring %s\n", name);
+        exit(1);
+    }
+
+    // Only events from now on
+    position = atomic_load(&ring->head);
+    for (;;) {
+        while (eventRingRead(ring, &position, &event, &lost)) {
+            printf("%10.6f  keypad %d  %-7s  row %d col %d  mode %d  keysym 0x%04x  %lu us after contact\n",
+                   event.timestamp / 1e9, event.keypad, typeNames[event.type < 4 ? event.type : 0], event.row, event.col,
+                   event.mode, event.keysym, (unsigned long) ((monotonicNanos() - event.detected) / 1000));
+        }
+        if (lost != reported) {
+            printf("(%u events missed)\n", lost - reported);
+            reported = lost;
+        }
+        fflush(stdout);
+        if (eventRingWait(ring, position, NULL) == -1 && errno != EAGAIN && errno != EINTR) {
+            break;
+        }
+        if (ring->magic != EVENT_RING_MAGIC) {
+            fprintf(stderr, "The driver has stopped\n");
+            break;
+        }
+    }
+
+    return 0;
+}
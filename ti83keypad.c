@@ -4,405 +4,809 @@
 ***************************************************/
 
 // To Do:
-// Add Screen to Black for Shutdown
 // Add functionality so that if you rightclick the status icon, it shows the about dialog (optional)
 // Remove any unused functions
-// Remove Debugging Messages (Search for g_print)
 // Polish up any other small details
 
 #include "ti83keypad.h"
 
-int getColCount(void)
+void brightnessUp(void)
 {
-    return sizeof(colPins) / sizeof(colPins[0]);
+    if (brightness < MAX_BRIGHTNESS) {
+        brightness += 1;
+        backlightSet(brightness * BACKLIGHT_MAX / MAX_BRIGHTNESS, BACKLIGHT_FADE);
+    }
 }
 
-void setValue(int outputValue)
+void brightnessDown(void)
 {
-    int bit;
-    for (bit = 0 ; bit < 8; ++bit) {
-        digitalWrite (100 + bit, outputValue & (1 << bit));
+    if (brightness > 0) {
+        brightness -= 1;
+        backlightSet(brightness * BACKLIGHT_MAX / MAX_BRIGHTNESS, BACKLIGHT_FADE);
+    }
+}
+
+// Take one step of the mode state machine (modes.h)
+void applyModeStep(Keypad *keypad, ModeStep step)
+{
+    int next = step.next;
+    
+    if ((step.flags & STEP_UNLESS_ALPHA_LOCK) && keypad->isAlphaLockActive) {
+        return;
+    }
+    if (step.flags & STEP_ALPHA_LOCK) {
+        keypad->isAlphaLockActive = !keypad->isAlphaLockActive;
+    }
+    if (step.flags & STEP_CONTROL_LOCK) {
+        keypad->isControlLockActive = !keypad->isControlLockActive;
+    }
+    if (step.flags & STEP_BRIGHT_UP) {
+        brightnessUp();
+    }
+    if (step.flags & STEP_BRIGHT_DOWN) {
+        brightnessDown();
+    }
+    
+    if (next == NEXT_LAST) {
+        next = keypad->lastMode;
+    } else if (next == NEXT_ALPHA) {
+        next = alphaLockModes[keypad->lastMode];
+    }
+    if (next != NEXT_STAY) {
+        changeMode(keypad, next);
     }
 }
 
-void setBit(int bit)
+#ifndef HEADLESS
+// Icons live in images/ beside the executable, wherever it was started from
+gchar * getImageDirectory(void)
 {
-    setValue(1 << bit);
+    gchar *exe = g_file_read_link("/proc/self/exe", NULL);
+    gchar *folder = g_path_get_dirname((exe != NULL) ? exe : executable->str);
+    gchar *images = g_build_filename(folder, "images", NULL);
+    
+    g_free(exe);
+    g_free(folder);
+    return images;
 }
 
-gboolean specialKey(KeySym keySym, int eventType)
+// Decode every mode icon once, so a mode change only swaps pixbufs
+void loadIcons(void)
 {
-    // If Special Key, respond and return true
-    if (eventType == EVENT_RELEASE) {
-        if (keySym == SPECIAL_ALPHA_UPPER_KEY) {
-            changeMode(MODE_ALPHA_UPPER);
-        } else if (keySym == SPECIAL_ALPHA_LOWER_KEY) {
-            changeMode(MODE_ALPHA_LOWER);
-        } else if (keySym == SPECIAL_2ND_KEY) {
-            changeMode(MODE_SECOND);
-        } else if (keySym == SPECIAL_NORMAL_KEY) {
-            changeMode(MODE_NORMAL);
-        } else if (keySym == SPECIAL_LOCK_KEY) {
-            changeAlphaLock();
-        } else if (keySym == SPECIAL_BRIGHT_UP_KEY) {
-            brightnessUp();
-        } else if (keySym == SPECIAL_BRIGHT_DOWN_KEY) {
-            brightnessDown();
-        } else if (keySym == SPECIAL_CONTROL_LOCK) {
-            changeControlLock();
+    gchar *folder = (imageDirectory != NULL) ? g_strdup(imageDirectory) : getImageDirectory();
+    gchar *path;
+    GError *error = NULL;
+    int iconMode;
+    
+    for (iconMode = MODE_NORMAL; iconMode <= MODE_TI83; iconMode++) {
+        path = g_build_filename(folder, notifyModeIcons[iconMode], NULL);
+        if ((modeIcons[iconMode] = gdk_pixbuf_new_from_file(path, &error)) == NULL) {
+            g_print("Can't load icon %s: %s\n", path, error->message);
+            g_clear_error(&error);
         }
+        g_free(path);
     }
+    g_free(folder);
+}
+
+// Runs at low priority on the GTK main loop, after any pending key events
+// have been injected; a burst of mode changes costs a single swap
+gboolean applyStatusIcon(gpointer data)
+{
+    int primaryMode = keypads[0].mode;
     
-    if (keySym == SPECIAL_ALPHA_UPPER_KEY ||
-        keySym == SPECIAL_ALPHA_LOWER_KEY ||
-        keySym == SPECIAL_2ND_KEY ||
-        keySym == SPECIAL_LOCK_KEY ||
-        keySym == SPECIAL_NORMAL_KEY ||
-        keySym == SPECIAL_BRIGHT_UP_KEY ||
-        keySym == SPECIAL_BRIGHT_DOWN_KEY ||
-        keySym == SPECIAL_CONTROL_LOCK) {
-        return TRUE;
+    iconUpdateSource = 0;
+    if (modeIcons[primaryMode] != NULL) {
+        gtk_status_icon_set_from_pixbuf(tray, modeIcons[primaryMode]);
     }
-    
+    gtk_status_icon_set_tooltip_text(tray, notifyModeNames[primaryMode]);
     return FALSE;
 }
 
-void brightnessUp(void)
+#endif
+
+void updateStatusIcon(void)
 {
-    if (brightness < MAX_BRIGHTNESS) {
-        brightness += 1;
-        softPwmWrite (BACKLIGHT_PIN, brightness);
+#ifndef HEADLESS
+    if (tray == NULL || iconUpdateSource != 0) {
+        return;
     }
-    g_print("Brightness Up [%i/%i]", brightness, MAX_BRIGHTNESS);
-    changeMode(MODE_NORMAL);
+    iconUpdateSource = g_idle_add_full(G_PRIORITY_LOW, applyStatusIcon, NULL, NULL);
+#endif
 }
 
-void brightnessDown(void)
+void changeMode(Keypad *keypad, int newMode)
 {
-    if (brightness > 0) {
-        brightness -= 1;
-        softPwmWrite (BACKLIGHT_PIN, brightness);
+    keypad->lastMode = keypad->mode;
+    keypad->mode = newMode;
+    repeatCancel();
+    cancelMacros();
+    modifiersReleaseAll();
+    if (modeClearsLocks[newMode] & STEP_ALPHA_LOCK) {
+        keypad->isAlphaLockActive = FALSE;
+    }
+    if (modeClearsLocks[newMode] & STEP_CONTROL_LOCK) {
+        keypad->isControlLockActive = FALSE;
+    }
+    // The tray and mode socket follow the first keypad
+    if (keypad->index == 0) {
+        updateStatusIcon();
+        notifyMode(newMode);
     }
-    g_print("Brightness Down [%i/%i]", brightness, MAX_BRIGHTNESS);
-    changeMode(MODE_NORMAL);
 }
 
-// This function handles lock status for the non-special keys
-void handleLockStatus(KeySym keySym)
+void cycleModes(Keypad *keypad)
 {
-    if (mode == MODE_SECOND) {
-        changeMode(lastMode);
-    } else if ((mode == MODE_ALPHA_LOWER || mode == MODE_ALPHA_UPPER) && isAlphaLockActive == FALSE) {
-        changeMode(MODE_NORMAL);
+    if (keypad->mode == MODE_TI83) {
+        changeMode(keypad, MODE_NORMAL);
+    } else {
+        changeMode(keypad, MODE_TI83);
     }
 }
 
-void changeAlphaLock(void)
+#ifndef HEADLESS
+void destroy(GtkWidget *widget, gpointer data)
 {
-    if (mode != MODE_SECOND) {
-        return;
-    }
+    loopQuit();
+}
+#endif
+
+gboolean isSpecialSymbol(KeySym keySym)
+{
+    return (keySym >= SPECIAL_ALPHA_UPPER_KEY && keySym <= SPECIAL_CONTROL_LOCK) ||
+           (keySym >= SPECIAL_MACRO_KEY && keySym < SPECIAL_MACRO_KEY + LAYOUT_MACROS);
+}
+
+// Resolve a layout entry against the current keymap
+KeyAction resolveKeySymbol(KeySym keySym)
+{
+    KeyAction action = { 0, 0, 0, ACTION_KEY };
     
-    if (isAlphaLockActive) {
-        isAlphaLockActive = FALSE;
-    } else {
-        isAlphaLockActive = TRUE;
+    if (isSpecialSymbol(keySym)) {
+        action.special = keySym;
+        action.modeAction = modeAction(keySym);
+        return action;
     }
     
-    if (lastMode == MODE_ALPHA_UPPER) {
-        changeMode(MODE_ALPHA_UPPER);
-    } else if (lastMode == MODE_ALPHA_LOWER || lastMode == MODE_NORMAL) {
-        changeMode(MODE_ALPHA_LOWER);
+    if (keySym == NoSymbol) {
+        return action;
     }
+    
+    action.keycode = output->resolve(keySym, &action.modifiers);
+    
+    return action;
 }
 
-void changeControlLock(void)
+// Called at startup and whenever the X keyboard mapping changes
+void buildKeyTable(void)
 {
-    if (isControlLockActive) {
-        isControlLockActive = FALSE;
-    } else {
-        isControlLockActive = TRUE;
+    int layoutMode, row, col;
+    unsigned char modifiers;
+    
+    for (layoutMode = MODE_NORMAL; layoutMode <= MODE_TI83; layoutMode++) {
+        for (row = 0; row <= ONKEY_ROW; row++) {
+            for (col = 0; col < COL_COUNT; col++) {
+                keyTable[layoutMode][row][col] = resolveKeySymbol(getKeySymbol(layoutMode, row, col));
+            }
+        }
     }
+    
+    shiftKeycode = output->resolve(XK_Shift_L, &modifiers);
+    controlKeycode = output->resolve(XK_Control_L, &modifiers);
+    modifiersSetOutput(output->sendKey, shiftKeycode, controlKeycode);
 }
 
-gchar * getImagePath(char * imageFile)
+void handleXEvents(int fd, void *data)
 {
-    // Can't get it working with autostart, so just using Absolute path for now
-    //char currentFolder[256];
-    //char pathSave[256];
-    const char* imageFolder = "/images/";
-    GString * imagePath = g_string_new("/home/pi/ti83keypad");
-/*
-    gchar * result = g_strstr_len (executable->str, 1, "/");
-    if (result == NULL) {
-        if (getcwd(currentFolder, sizeof(currentFolder)) == NULL) {
-            g_print ("Error getting Current Working Directory\n");
+    XEvent event;
+    
+    while (XPending(display)) {
+        XNextEvent(display, &event);
+        if (event.type == MappingNotify) {
+            XRefreshKeyboardMapping(&event.xmapping);
+            buildKeyTable();
         }
-    } else {
-        getcwd(pathSave, sizeof(pathSave));
-        chdir(executable->str);
-        getcwd(currentFolder, sizeof(currentFolder));
-        chdir(pathSave);
-    }*/
+    }
+}
 
-    //g_string_append(imagePath, (char*) currentFolder);
-    g_string_append(imagePath, imageFolder);
-    g_string_append(imagePath, imageFile);
+void emulateKeyPress(Keypad *keypad, const KeyAction *action)
+{
+    ModeStep step = modeStep(keypad->mode, action->modeAction);
+    
+    // Mode keys act when released
+    if (step.flags & STEP_ON_RELEASE) {
+        return;
+    }
+    applyModeStep(keypad, step);
 
-    return imagePath->str;
+    if (action->modeAction == ACTION_MACRO) {
+        playMacro(action->special - SPECIAL_MACRO_KEY);
+        return;
+    }
+
+    if (action->keycode == 0) {
+        return;
+    }
+    
+    modifiersKeyPress((action->modifiers & ShiftMask) | (keypad->isControlLockActive ? ControlMask : 0));
+    output->sendKey(action->keycode, True);
 }
 
-gchar * getModeIconImage(void)
+void emulateKeyRelease(Keypad *keypad, const KeyAction *action)
 {
-    if (mode == MODE_SECOND) {
-        return "2nd.png";
-    } else if (mode == MODE_ALPHA_LOWER) {
-        return "lowercase.png";
-    } else if (mode == MODE_ALPHA_UPPER) {
-        return "uppercase.png";
-    } else if (mode == MODE_TI83) {
-        return "ti83mode.png";
+    ModeStep step = modeStep(keypad->mode, action->modeAction);
+    
+    if (step.flags & STEP_ON_RELEASE) {
+        applyModeStep(keypad, step);
+        return;
     }
     
-    return "numbers.png";
+    if (action->keycode == 0) {
+        return;
+    }
+
+    output->sendKey(action->keycode, False);
+
+    // Control lock covers a single key
+    keypad->isControlLockActive = FALSE;
+    modifiersKeyRelease(ControlMask);
 }
 
-void updateStatusIcon(void)
+void shutdown(void)
 {
-    gtk_status_icon_set_from_file (tray, getImagePath(getModeIconImage()));
+    if (gpio != &wiringPiBackend) {
+        return;
+    }
+    backlightFadeOut(SHUTDOWN_FADE);
+    system ("sudo shutdown -h now");
 }
 
-void changeMode(int newMode)
+KeySym getKeySymbol(int layoutMode, int row, int col)
 {
-    lastMode = mode;
-    mode = newMode;
-    if (newMode == MODE_NORMAL || newMode == MODE_TI83) {
-        isAlphaLockActive = FALSE;
-        isControlLockActive = FALSE;
+    if (row == ONKEY_ROW) {
+        return (layoutMode == MODE_TI83 && col == 0) ? XK_F12 : NoSymbol;
     }
-    if (newMode == MODE_SECOND) {
-        isControlLockActive = FALSE;
+
+    if (layoutImage != NULL) {
+        return layoutImage->symbols[layoutMode - 1][row][col];
     }
-    updateStatusIcon();
+    
+    return builtinLayouts[layoutMode][row][col];
 }
 
-void cycleModes(void)
+void setup(void)
 {
-    if (mode == MODE_TI83) {
-        changeMode(MODE_NORMAL);
-    } else {
-        changeMode(MODE_TI83);
+    int i;
+    
+    for (i = 0; i < keypadCount; i++) {
+        if (gpio->setup(&keypads[i].matrix) == -1) {
+            g_print("GPIO setup error (%s, keypad %i)\n", gpio->name, i);
+            exit(1);
+        }
+    }
+    
+    if ((display = XOpenDisplay(NULL)) == NULL && output->needsDisplay) {
+        g_print("XOpenDisplay Initialization Failure\n");
+        exit(2);
+    }
+    
+    if (output->setup(display) == -1) {
+        g_print("Output Initialization Failure (%s)\n", output->name);
+        exit(2);
+    }
+    
+    if (layoutPath == NULL || !loadLayouts(layoutPath)) {
+        buildKeyTable();
     }
+    
+    backlightInit(gpio == &wiringPiBackend, brightness * BACKLIGHT_MAX / MAX_BRIGHTNESS);
+    backlightSetIdle(idleDim * 1000, idleOff * 1000, IDLE_DIM_LEVEL);
 }
 
-void destroy(GtkWidget *widget, gpointer data)
+// Raw key identities for other processes, ahead of any injection
+void publishEvent(Keypad *keypad, const KeyEvent *event, int keyMode)
 {
-    gtk_main_quit ();
+    RingEvent published;
+    
+    published.keysym = (event->type == EVENT_CHORD) ? NoSymbol : getKeySymbol(keyMode, event->row, event->col);
+    published.timestamp = event->timestamp;
+    published.detected = event->detected;
+    published.type = event->type;
+    published.row = event->row;
+    published.col = event->col;
+    published.mode = keyMode;
+    published.keypad = keypad->index;
+    eventRingPublish(&published);
 }
 
-gboolean isShiftRequired(KeySym keySym)
+void handleKeyEvent(Keypad *keypad, const KeyEvent *event)
 {
-    // Check if a Shift is Required
-    for (int i = 0; i < SHIFT_SYMBOL_SIZE; i++) {
-        if (keySym == shiftSymbols[i]) {
-            return TRUE;
+    gboolean powerDown;
+    const KeyAction *action;
+    const RepeatSetting *setting;
+    int mode = keypad->mode;
+    int key = KEYPAD_KEY(keypad, event->row, event->col);
+    
+    if (event->type == EVENT_CHORD) {
+        // The chord's keys mean something else in the modes it leaves out
+        if (chords[event->col].modes != 0 && !(chords[event->col].modes & MODE_BIT(mode))) {
+            return;
+        }
+        publishEvent(keypad, event, mode);
+        if (event->row == CHORD_MODE_CYCLE) {
+            cycleModes(keypad);
+        } else if (event->row == CHORD_POWER_DOWN) {
+            g_print("Power Down\n");
+            shutdown();
         }
+        return;
     }
     
-    return FALSE;
+    if (event->type == EVENT_PRESS) {
+        publishEvent(keypad, event, mode);
+        keypad->pressedModes[event->row][event->col] = mode;
+        backlightActivity();
+        // ON in 2nd mode powers down
+        powerDown = (event->row == ONKEY_ROW && mode == MODE_SECOND);
+        action = &keyTable[mode][event->row][event->col];
+        keypad->pressedActions[event->row][event->col] = *action;
+        // Only plain keys that type something repeat, so a NoSymbol key leaves a held
+        // key's repeat alone, and the mode is read before the press can change it
+        setting = NULL;
+        if (isRepeatEnabled && event->row < ROW_COUNT && action->special == 0 && action->keycode != 0) {
+            setting = keyRepeat[event->row][event->col].delay ? &keyRepeat[event->row][event->col] : &modeRepeat[mode];
+        }
+        emulateKeyPress(keypad, &keypad->pressedActions[event->row][event->col]);
+        if (setting != NULL) {
+            repeatStart(setting, action->keycode, key);
+        }
+        if (powerDown) {
+            g_print("Power Down\n");
+            shutdown();
+        }
+    } else if (event->type == EVENT_RELEASE) {
+        publishEvent(keypad, event, keypad->pressedModes[event->row][event->col]);
+        // Release what was pressed, even if the mode has changed since
+        repeatStop(key);
+        emulateKeyRelease(keypad, &keypad->pressedActions[event->row][event->col]);
+    }
 }
 
-void emulateKeyPress(KeySym keySym)
+// Record latency for the events that just went out with a flush
+void recordInjected(const KeyEvent *events, int count)
 {
-    KeyCode modcode = 0; //init value
-    isKeyPressed = TRUE;
+    int i;
+    uint64_t now;
     
-    if (specialKey(keySym, EVENT_PRESS)) {
-        return;
-    } else {
-        handleLockStatus(keySym);
+    output->flush();
+    now = monotonicNanos();
+    for (i = 0; i < count; i++) {
+        histogramRecord(&stats->acceptToInject, now - events[i].timestamp);
+        histogramRecord(&stats->detectToInject, now - events[i].detected);
     }
+    atomic_store(&stats->eventsInjected, outputKeyEvents);
+    atomic_store(&stats->flushes, outputFlushes);
+}
 
-    if (keySym == NoSymbol) {
+// Runs on the main loop for backlight fades and idle timeouts
+void handleBacklight(int fd, void *data)
+{
+    backlightExpired();
+}
+
+// Runs on the main loop when the scanner hands over a full trace buffer
+void handleTrace(int fd, void *data)
+{
+    traceWriterDrain(data);
+}
+
+// Runs on the main loop when the repeat timer fires. The key is
+// released and pressed again so X sees fresh events, while any
+// modifiers from the original press stay held
+void handleRepeat(int fd, void *data)
+{
+    unsigned int keycode = repeatExpired();
+    
+    if (keycode != 0) {
+        output->sendKey(keycode, False);
+        output->sendKey(keycode, True);
+        recordInjected(NULL, 0);
+    }
+}
+
+// Expands a layout macro into key events for handleMacros to play
+void playMacro(int number)
+{
+    MacroEvent events[LAYOUT_STEPS * 2];
+    const uint32_t *steps;
+    unsigned long pause = 0;
+    unsigned char modifiers;
+    KeyCode keycode;
+    int i, count = 0;
+    
+    if (layoutImage == NULL) {
         return;
     }
     
-    modcode = XKeysymToKeycode(display, keySym);
+    steps = layoutImage->macros[number];
+    for (i = 0; i < LAYOUT_STEPS && steps[i] != NoSymbol; i++) {
+        if (steps[i] & LAYOUT_PAUSE) {
+            pause += steps[i] & ~LAYOUT_PAUSE;
+            continue;
+        }
+        if ((keycode = output->resolve(steps[i], &modifiers)) == 0) {
+            continue;
+        }
+        if (pause > 0xffff) {
+            pause = 0xffff;
+        }
+        events[count++] = (MacroEvent) { pause, keycode, True, modifiers & ShiftMask };
+        events[count++] = (MacroEvent) { 0, keycode, False, 0 };
+        pause = 0;
+    }
     
-    if (isShiftRequired(keySym)) {
-        //g_print("Event: Shift Pressed\n");
-        XTestFakeKeyEvent(display, XKeysymToKeycode(display, XK_Shift_L), True, 0);
-        XFlush(display);
+    if (macroQueue(events, count) == -1) {
+        g_print("Macro %i dropped, playback queue full\n", number);
+        return;
     }
+    macroSchedule(output->sendKeyAfter != NULL);
+}
 
-    if (isControlLockActive) {
-        //g_print("Event: Control Pressed\n");
-        XTestFakeKeyEvent(display, XKeysymToKeycode(display, XK_Control_L), True, 0);
-        XFlush(display);
+void sendMacroKey(KeyCode keycode, Bool isPress, unsigned long delay, int canDelay)
+{
+    if (canDelay) {
+        output->sendKeyAfter(keycode, isPress, delay);
+    } else {
+        output->sendKey(keycode, isPress);
     }
+}
 
-    //g_print("Event: Key Pressed\n");
+// Runs on the main loop when the next batch of a macro is due. Shift goes
+// through the modifier tracker, only where it changes between steps, and
+// is let go after the last one.
+void handleMacros(int fd, void *data)
+{
+    MacroEvent batch[MACRO_BATCH_SIZE];
+    ModifierChange changes[MODIFIER_CHANGES];
+    int canDelay = (output->sendKeyAfter != NULL);
+    unsigned long delay;
+    int i, j, count, changeCount;
     
-    XTestFakeKeyEvent(display, modcode, True, 0);
-    XFlush(display);
+    count = macroNext(batch, MACRO_BATCH_SIZE, canDelay);
+    for (i = 0; i < count; i++) {
+        delay = batch[i].delay;
+        changeCount = batch[i].isPress ? modifiersChange(batch[i].modifiers, changes) : 0;
+        for (j = 0; j < changeCount; j++) {
+            sendMacroKey(changes[j].keycode, changes[j].isPress, delay, canDelay);
+            delay = 0;
+        }
+        sendMacroKey(batch[i].keycode, batch[i].isPress, delay, canDelay);
+    }
+    if (count > 0 && macroPending() == 0) {
+        changeCount = modifiersSettle(changes);
+        for (j = 0; j < changeCount; j++) {
+            sendMacroKey(changes[j].keycode, changes[j].isPress, 0, canDelay);
+        }
+    }
+    if (count > 0) {
+        recordInjected(NULL, 0);
+    }
+    macroSchedule(canDelay);
 }
 
-void emulateKeyRelease(KeySym keySym)
+// Stops a macro part way, for mode changes, layout reloads and shutdown.
+// A key it left pressed is released, as is Shift if nothing else holds it.
+void cancelMacros(void)
 {
-    KeyCode modcode = 0; //init value
-    isKeyPressed = FALSE;
+    MacroEvent release;
+    ModifierChange changes[MODIFIER_CHANGES];
+    int j, changeCount;
     
-    if (specialKey(keySym, EVENT_RELEASE)) {
+    if (macroPending() == 0) {
         return;
     }
-    
-    if (keySym == NoSymbol) {
-        return;
+    if (macroCancel(&release)) {
+        output->sendKey(release.keycode, False);
     }
+    changeCount = modifiersSettle(changes);
+    for (j = 0; j < changeCount; j++) {
+        output->sendKey(changes[j].keycode, changes[j].isPress);
+    }
+    recordInjected(NULL, 0);
+}
 
-    modcode = XKeysymToKeycode(display, keySym);
+void handleModeClient(int fd, void *data)
+{
+    notifyAccept(fd);
+}
+
+// Commands from mode socket clients: "mode N", or "mode N K" for keypad K
+void handleCommand(int fd, const char *command)
+{
+    int newMode;
+    int index = 0;
     
-    //g_print("Event: Key Released\n");
-    XTestFakeKeyEvent(display, modcode, False, 0);
-    XFlush(display);
+    if (sscanf(command, "mode %d %d", &newMode, &index) >= 1) {
+        if (index < 0 || index >= keypadCount) {
+            notifyReply(fd, "error no such keypad\n");
+        } else if (newMode >= MODE_NORMAL && newMode <= MODE_TI83) {
+            changeMode(&keypads[index], newMode); // Every client hears the first keypad's new mode
+            recordInjected(NULL, 0);
+            if (index != 0) {
+                notifyReply(fd, "ok\n");
+            }
+        } else {
+            notifyReply(fd, "error no such mode\n");
+        }
+    } else {
+        notifyReply(fd, "error unknown command\n");
+    }
+}
 
-    if (isControlLockActive) {
-        //g_print("Event: Control Pressed\n");
-        XTestFakeKeyEvent(display, XKeysymToKeycode(display, XK_Control_L), True, 0);
-        XFlush(display);
-        isControlLockActive = FALSE;
+void handleSignal(int fd, void *data)
+{
+    struct signalfd_siginfo info;
+    
+    if (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        g_print("Stopping on signal %u\n", info.ssi_signo);
+        loopQuit();
     }
+}
 
-    if (isShiftRequired(keySym)) {
-        //g_print("Event: Shift Released\n");
-        XTestFakeKeyEvent(display, XKeysymToKeycode(display, XK_Shift_L), False, 0);
-        XFlush(display);
+// Runs on the main loop whenever the scanner thread signals eventFd
+void drainEvents(int fd, void *data)
+{
+    uint64_t count;
+    KeyEvent event;
+    KeyEvent batch[INJECT_BATCH_SIZE];
+    int batchCount = 0;
+    int i;
+    
+    if (read(eventFd, &count, sizeof(count)) != sizeof(count)) {
+        return;
     }
     
+    // Every scanner thread shares the one eventfd
+    for (i = 0; i < keypadCount; i++) {
+        while (keyQueuePop(&keypads[i].queue, &event)) {
+            handleKeyEvent(&keypads[i], &event);
+            if (event.type != EVENT_CHORD) {
+                batch[batchCount++] = event;
+            }
+            if (batchCount == INJECT_BATCH_SIZE) {
+                recordInjected(batch, batchCount);
+                batchCount = 0;
+            }
+        }
+    }
+    
+    // One wake for readers and one flush for everything this batch produced
+    eventRingWake();
+    recordInjected(batch, batchCount);
 }
 
-void shutdown(void)
+// Print handler that drops everything, to keep chatter out of benchmark output
+void discardPrint(const gchar *message)
 {
-    // Would like something to change brightness to 0
-    // Maybe it has something to do with system not blacking out screen anymore...
-    system ("sudo shutdown -h now");
 }
 
-KeySym getKeySymbol(int row, int col)
+// Push a generated trace through the real scanner, debounce and mode logic
+// on a simulated clock, into the output under test. One pass at tier, or
+// adapting with -1.
+void benchmarkPass(int keystrokes, int tier)
 {
-    if (mode == MODE_TI83) {
-        return ti83Layout[row][col];
-    } else if (mode == MODE_ALPHA_UPPER) {
-        return alphaUpperLayout[row][col];
-    } else if (mode == MODE_ALPHA_LOWER) {
-        return alphaLowerLayout[row][col];
-    } else if (mode == MODE_SECOND) {
-        return secondLayout[row][col];
+    SimTrace trace;
+    SimKeystroke *strokes = g_new(SimKeystroke, keystrokes);
+    Histogram *latency = g_new0(Histogram, 1);
+    KeyEvent event;
+    struct timespec cpuStart, cpuEnd;
+    Keypad *keypad = &keypads[0];
+    uint64_t now, end, wallStart, wallTime, cpuTime;
+    unsigned long scans = 0;
+    unsigned long eventsBefore = outputKeyEvents;
+    unsigned long flushesBefore = outputFlushes;
+    GPrintFunc print;
+    
+    simTraceGenerate(&trace, strokes, keystrokes, 83);
+    end = simTraceEnd(&trace) + IDLE_DELAY * 1000000ull;
+    keyQueueInit(&keypad->queue);
+    scannerPinTier(&keypad->scanner, tier);
+    scannerInit(&keypad->scanner, &keypad->matrix, &keypad->queue, -1);
+    changeMode(keypad, MODE_NORMAL);
+    // Keep mode and brightness chatter out of the results
+    print = g_set_print_handler(discardPrint);
+    
+    wallStart = monotonicNanos();
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+    for (now = 0; now < end; ) {
+        simTraceApply(&trace, &keypad->matrix, now);
+        now += scannerScanOnce(&keypad->scanner, now);
+        scans++;
+        while (keyQueuePop(&keypad->queue, &event)) {
+            handleKeyEvent(keypad, &event);
+            if (event.type != EVENT_CHORD) {
+                histogramRecord(latency, event.timestamp - trace.lastEdge[event.row][event.col]);
+            }
+        }
+        output->flush();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+    wallTime = monotonicNanos() - wallStart;
+    cpuTime = (cpuEnd.tv_sec - cpuStart.tv_sec) * 1000000000ull + cpuEnd.tv_nsec - cpuStart.tv_nsec;
+    g_set_print_handler(print);
+    
+    if (tier >= 0) {
+        g_print("%6u us ", scanTiers[tier]);
+    } else {
+        g_print("adaptive ");
     }
+    // Load is the scanning CPU time as a share of the simulated time it covered
+    g_print("%9lu %8.2f us %8.4f%% %8.1f ms %8.1f ms %10lu %8lu %10.0f/s\n", scans, cpuTime / 1000.0 / scans,
+            100.0 * cpuTime / end, histogramPercentile(latency, 0.50) / 1000.0,
+            histogramPercentile(latency, 0.99) / 1000.0, outputKeyEvents - eventsBefore,
+            outputFlushes - flushesBefore, (outputKeyEvents - eventsBefore) / (wallTime / 1e9));
     
-    return normalLayout[row][col];
+    g_free(strokes);
+    g_free(latency);
 }
 
-void setup(void)
+// The per-key flushing the driver did before batching, as a baseline for --bench
+void flushEachSendKey(KeyCode keycode, Bool isPress)
 {
-    int i;
+    flushEachTarget->sendKey(keycode, isPress);
+    flushEachTarget->flush();
+}
+
+// CPU against detection latency at every scan rate tier, then adapting
+void runBenchmark(int keystrokes)
+{
+    int tier;
     
-    if (wiringPiSetup() == -1) {
-        g_print("wiringPiSetup error\n");
-        exit(1);
+    g_print("%d keystrokes at each scan rate, into the %s output%s\n", keystrokes, output->name,
+            (output == &flushEachOutput) ? ", flushed after every key" : "");
+    g_print("  Rate       Scans  CPU/scan     Load   Lat p50   Lat p99     Events  Flushes    Events/s\n");
+    for (tier = 0; tier < SCAN_TIERS; tier++) {
+        benchmarkPass(keystrokes, tier);
     }
+    benchmarkPass(keystrokes, -1);
+    scannerPinTier(&keypads[0].scanner, -1);
+}
+
+// Swap in a compiled layout image. Runs on the same thread as the key handling,
+// and held keys release with the action they were pressed with, so nothing
+// in flight is lost.
+gboolean loadLayouts(const char *path)
+{
+    const LayoutImage *oldImage = layoutImage;
+    const LayoutImage *newImage = layoutImageMap(path);
     
-    if ((display = XOpenDisplay(NULL)) == NULL) {
-        g_print("XOpenDisplay Initialization Failure\n");
-        exit(2);
+    if (newImage == NULL) {
+        g_print("Can't load layouts from %s, keeping the current ones\n", path);
+        return FALSE;
     }
     
-    sr595Setup (100, 8, DATA_PIN, CLOCK_PIN, LATCH_PIN) ;
-    softPwmCreate (BACKLIGHT_PIN, MAX_BRIGHTNESS, MAX_BRIGHTNESS);
-    colCount = getColCount();
+    // Queued macro steps carry keycodes from the old layouts
+    cancelMacros();
+    layoutImage = newImage;
+    buildKeyTable();
+    layoutImageUnmap(oldImage);
+    g_print("Loaded layouts from %s\n", path);
+    return TRUE;
+}
+
+// ti83layout replaces the image with a rename, so watch the directory
+void watchLayouts(void)
+{
+    gchar *folder = g_path_get_dirname(layoutPath);
     
-    for (i = 0; i < colCount; i++) {   // Set column pins for input, with pullup.
-        pinMode(colPins[i], INPUT);
-        pullUpDnControl (colPins[i], PUD_DOWN);
+    if ((layoutWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 ||
+        inotify_add_watch(layoutWatchFd, folder, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        g_print("Can't watch %s for layout changes\n", folder);
+    } else {
+        loopWatch(layoutWatchFd, handleLayoutChange, NULL);
     }
+    g_free(folder);
 }
 
-gboolean loop(gpointer data)
-{   
-    int row, col;
-    gboolean keyFound = FALSE;
+void handleLayoutChange(int fd, void *data)
+{
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    gchar *name = g_path_get_basename(layoutPath);
+    gboolean changed = FALSE;
+    ssize_t length, offset;
+    
+    while ((length = read(layoutWatchFd, buffer, sizeof(buffer))) > 0) {
+        for (offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) (buffer + offset);
+            if (event->len && g_strcmp0(event->name, name) == 0) {
+                changed = TRUE;
+            }
+        }
+    }
+    g_free(name);
+    
+    if (changed) {
+        loadLayouts(layoutPath);
+    }
+}
+
+// Scan one replayed sample and hand the resulting events to the mode logic
+// Returns the period until the next scan
+uint64_t replayScan(Keypad *keypad, const uint8_t *rows, uint64_t now, uint64_t startTime)
+{
+    const char *eventNames[] = { "", "press", "release", "chord" };
+    KeyEvent event;
     KeySym ks;
+    uint64_t period;
+    int mode;
     
-    if (isKeyPressed) {
-        return FALSE;
+    simSetMatrix(&keypad->matrix, rows, rows[ONKEY_ROW]);
+    period = scannerScanOnce(&keypad->scanner, now);
+    while (keyQueuePop(&keypad->queue, &event)) {
+        // A release shows what its press sent, as handleKeyEvent releases it
+        mode = (event.type == EVENT_RELEASE) ? keypad->pressedModes[event.row][event.col] : keypad->mode;
+        ks = (event.type == EVENT_CHORD) ? NoSymbol : getKeySymbol(mode, event.row, event.col);
+        g_print("%10.3f  %-7s  row %d col %d  mode %d  %s\n", (now - startTime) / 1e9,
+                eventNames[event.type], event.row, event.col, mode,
+                (ks == NoSymbol || isSpecialSymbol(ks)) ? "-" : XKeysymToString(ks));
+        handleKeyEvent(keypad, &event);
     }
+    output->flush();
+    
+    return period;
+}
 
-    for (row = 0; row < 8; row++) {
-        setBit(row);
-        for (col = 0; col < colCount; col++) {
-            if (digitalRead(colPins[col]) == HIGH) {
-                ks = getKeySymbol(row, col);
-                emulateKeyPress(ks);
-                while (keyFound == FALSE && digitalRead(colPins[col]) == HIGH) {
-                    if (ks == XK_F11 && digitalRead(ONKEY_PIN) == LOW) {
-                        g_print("Mode Change Key Combo Detected\n");
-                        cycleModes();
-                        keyFound = TRUE;
-                    }
-                };
-                emulateKeyRelease(ks);
-                keyFound = TRUE;                            // Force exit of both for loops.
-            }
-            
-            if (keyFound) break;
-        }
-        if (keyFound) {
-            delay(BOUNCE_DELAY);
-            break;
-        }
+// Feed a recorded trace back through the first keypad's scanner, debounce and
+// mode logic, either as fast as possible or at the pace it was recorded
+void runReplay(const char *path, gboolean realtime)
+{
+    Keypad *keypad = &keypads[0];
+    TraceReader reader;
+    uint8_t rows[TRACE_ROWS] = {0};
+    uint64_t previous, now, wallStart;
+    struct timespec deadline;
+    uint32_t scans, i;
+    
+    if (traceReaderOpen(&reader, path) == -1) {
+        g_print("Can't read trace %s\n", path);
+        exit(5);
     }
+    if (reader.scanPeriod != scanTiers[0]) {
+        g_print("Trace was recorded with a %u us fastest scan period, replaying at %u us\n",
+                reader.scanPeriod, scanTiers[0]);
+    }
+    
+    keyQueueInit(&keypad->queue);
+    scannerInit(&keypad->scanner, &keypad->matrix, &keypad->queue, -1);
+    wallStart = monotonicNanos();
+    previous = reader.startTime;
     
-    if (digitalRead(ONKEY_PIN) == LOW) {
-        if (!keyFound) {
-            if (mode == MODE_TI83) {
-                // Emulate F12 and Check For Mode Change Combo
-                emulateKeyPress(XK_F12);
-                while (keyFound == FALSE && digitalRead(ONKEY_PIN) == LOW) {
-                    setBit(0);
-                    if (digitalRead(colPins[0]) == HIGH) {
-                        g_print("Mode Change Key Combo Detected\n");
-                        cycleModes();
-                        keyFound = TRUE;
-                    }
-                };
-                emulateKeyRelease(XK_F12);
-                delay(BOUNCE_DELAY);
-            } else if (mode == MODE_SECOND) {
-                emulateKeyPress(NoSymbol);
-                // Power Down
-                g_print("Power Down\n");
-                shutdown();
-                // So that we don't keep looping
-                while (digitalRead(ONKEY_PIN) == LOW);
-                emulateKeyRelease(NoSymbol);
-            } else {
-                // Check For Mode Change Combo
-                emulateKeyPress(NoSymbol);
-                while (keyFound == FALSE && digitalRead(ONKEY_PIN) == LOW) {
-                    setBit(0);
-                    if (digitalRead(colPins[0]) == HIGH) {
-                        g_print("Mode Change Key Combo Detected\n");
-                        cycleModes();
-                        keyFound = TRUE;
-                    }
-                };
-                emulateKeyRelease(NoSymbol);
-                delay(BOUNCE_DELAY);
+    while (traceReaderNext(&reader, &scans)) {
+        // The matrix held still for every scan but the last one
+        for (i = 1; i <= scans; i++) {
+            now = previous + (reader.time - previous) * i / scans;
+            if (i == scans) {
+                memcpy(rows, reader.rows, TRACE_ROWS);
             }
+            if (realtime) {
+                deadline.tv_sec = (wallStart + now - reader.startTime) / 1000000000ull;
+                deadline.tv_nsec = (wallStart + now - reader.startTime) % 1000000000ull;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+            }
+            replayScan(keypad, rows, now, reader.startTime);
         }
+        previous = reader.time;
     }
     
-    return TRUE;
+    // Let the debouncer settle after the last change
+    for (now = previous; now < previous + IDLE_DELAY * 1000000ull; ) {
+        now += replayScan(keypad, rows, now, reader.startTime);
+    }
+    
+    traceReaderClose(&reader);
+    g_print("Replayed %.3f s, %lu events injected in %lu flushes\n",
+            (previous - reader.startTime) / 1e9, outputKeyEvents, outputFlushes);
 }
 
 /*
@@ -422,27 +826,355 @@ static void show_about( GtkWidget *widget, gpointer data )
 */
 
 
+// All of text as a number from min to max
+gboolean parseNumber(const char *text, long min, long max, int *value)
+{
+    char *end;
+    long number;
+    
+    errno = 0;
+    number = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || number < min || number > max) {
+        return FALSE;
+    }
+    *value = number;
+    return TRUE;
+}
+
+// Reads a --keypad spec such as "rows=4,cols=5,latch=22,on=-1,columns=5:6:13:19:12,cpu=3"
+// over the TI-83 wiring. cpu is left alone unless the spec names one.
+gboolean parseKeypad(const char *spec, MatrixPins *pins, int *cpu)
+{
+    gchar **fields = g_strsplit(spec, ",", -1);
+    gchar **columns;
+    gboolean valid = TRUE;
+    int i, j;
+    
+    *pins = ti83Pins;
+    for (i = 0; fields[i] != NULL && valid; i++) {
+        if (g_str_has_prefix(fields[i], "columns=")) {
+            columns = g_strsplit(fields[i] + strlen("columns="), ":", -1);
+            for (j = 0; columns[j] != NULL && j < COL_COUNT && valid; j++) {
+                valid = parseNumber(columns[j], 0, PIN_MAX, &pins->colPins[j]);
+            }
+            valid = valid && (columns[j] == NULL);
+            g_strfreev(columns);
+        } else if (g_str_has_prefix(fields[i], "rows=")) {
+            valid = parseNumber(fields[i] + strlen("rows="), 1, ROW_COUNT, &pins->rows);
+        } else if (g_str_has_prefix(fields[i], "cols=")) {
+            valid = parseNumber(fields[i] + strlen("cols="), 1, COL_COUNT, &pins->cols);
+        } else if (g_str_has_prefix(fields[i], "clock=")) {
+            valid = parseNumber(fields[i] + strlen("clock="), 0, PIN_MAX, &pins->clockPin);
+        } else if (g_str_has_prefix(fields[i], "data=")) {
+            valid = parseNumber(fields[i] + strlen("data="), 0, PIN_MAX, &pins->dataPin);
+        } else if (g_str_has_prefix(fields[i], "latch=")) {
+            valid = parseNumber(fields[i] + strlen("latch="), 0, PIN_MAX, &pins->latchPin);
+        } else if (g_str_has_prefix(fields[i], "on=")) {
+            valid = parseNumber(fields[i] + strlen("on="), -1, PIN_MAX, &pins->onKeyPin);
+        } else if (g_str_has_prefix(fields[i], "cpu=")) {
+            valid = parseNumber(fields[i] + strlen("cpu="), 0, sysconf(_SC_NPROCESSORS_CONF) - 1, cpu);
+        } else {
+            valid = FALSE;
+        }
+    }
+    g_strfreev(fields);
+    
+    return valid;
+}
+
+// Reads a --debounce spec of press and release Milliseconds, such as "5,15"
+gboolean parseDebounce(const char *spec, int *pressMillis, int *releaseMillis)
+{
+    gchar **fields = g_strsplit(spec, ",", -1);
+    gboolean valid;
+    
+    valid = (g_strv_length(fields) == 2 &&
+             parseNumber(fields[0], 0, DEBOUNCE_MAX_TIME, pressMillis) &&
+             parseNumber(fields[1], 0, DEBOUNCE_MAX_TIME, releaseMillis));
+    g_strfreev(fields);
+    
+    return valid;
+}
+
+// Every keypad gets its own matrix, scanner and mode state. Layouts and the output are shared.
+void addKeypad(const MatrixPins *pins)
+{
+    Keypad *keypad = &keypads[keypadCount];
+    
+    memset(keypad, 0, sizeof(Keypad));
+    keypad->index = keypadCount++;
+    keypad->mode = MODE_NORMAL;
+    keypad->lastMode = MODE_NORMAL;
+    gpioMatrixInit(&keypad->matrix, gpio, pins);
+    keyQueueInit(&keypad->queue);
+    scannerDefaults(&keypad->scanner);
+    scannerSetChords(&keypad->scanner, chords, CHORD_COUNT);
+    scannerSetDebounce(&keypad->scanner, debouncePress, debounceRelease);
+}
+
+// Synthetic CPU load, to see how scan jitter holds up on a busy box
+void *burnCpu(void *data)
+{
+    volatile unsigned long spins = 0;
+    
+    for (;;) {
+        spins++;
+    }
+    return NULL;
+}
+
+void startStress(int threads)
+{
+    pthread_t thread;
+    int i;
+    
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&thread, NULL, burnCpu, NULL) == 0) {
+            pthread_detach(thread);
+        }
+    }
+    g_print("Loading the CPU with %d busy threads\n", threads);
+}
+
 int main(int argc, char *argv[])
 {
+    int i;
+    int benchKeystrokes = 0;
+    const char *recordPath = NULL;
+    const char *replayPath = NULL;
+    gboolean realtime = FALSE;
+    gboolean benchOutput = FALSE, flushEachKey = FALSE;
+    int modeSocket, modeFd = -1, signalFd;
+    int realtimePriority = 0, realtimeCpu = -1, cpu;
+    int stressThreads = 0;
+    MatrixPins keypadPins[MATRIX_MAX];
+    int keypadCpus[MATRIX_MAX];
+    int specCount = 0;
+    uint32_t usedPins = 1u << BACKLIGHT_PIN, pinMask;
+    char hello[NOTIFY_LINE];
+    sigset_t signals;
+    
     executable = g_string_new("");
     g_string_append(executable, argv[0]);
     
+    for (i = 1; i < argc; i++) {
+        if (g_strcmp0(argv[i], "--simulate") == 0) {
+            gpio = &simulatedBackend;
+#ifdef USE_XCB
+        } else if (g_strcmp0(argv[i], "--xcb") == 0) {
+            output = &xcbOutput;
+#endif
+        } else if (g_strcmp0(argv[i], "--uinput") == 0) {
+            output = &uinputOutput;
+        } else if (g_str_has_prefix(argv[i], "--uinput-sink=")) {
+            output = &uinputOutput;
+            uinputSetSink(argv[i] + strlen("--uinput-sink="));
+        } else if (g_strcmp0(argv[i], "--bench") == 0 && i + 1 < argc) {
+            benchKeystrokes = atoi(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--bench-output") == 0) {
+            benchOutput = TRUE;
+        } else if (g_strcmp0(argv[i], "--flush-each") == 0) {
+            flushEachKey = TRUE;
+        } else if (g_strcmp0(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (g_strcmp0(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (g_strcmp0(argv[i], "--realtime") == 0) {
+            realtime = TRUE;
+        } else if (g_strcmp0(argv[i], "--rt") == 0) {
+            realtimePriority = REALTIME_PRIORITY;
+        } else if (g_strcmp0(argv[i], "--rt-cpu") == 0 && i + 1 < argc) {
+            realtimeCpu = atoi(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--stress") == 0 && i + 1 < argc) {
+            stressThreads = atoi(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--idle-dim") == 0 && i + 1 < argc) {
+            idleDim = atoi(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--idle-off") == 0 && i + 1 < argc) {
+            idleOff = atoi(argv[++i]);
+#ifndef HEADLESS
+        } else if (g_strcmp0(argv[i], "--images") == 0 && i + 1 < argc) {
+            imageDirectory = argv[++i];
+#endif
+        } else if (g_strcmp0(argv[i], "--mode-fd") == 0 && i + 1 < argc) {
+            modeFd = atoi(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--debounce") == 0 && i + 1 < argc) {
+            if (!parseDebounce(argv[++i], &debouncePress, &debounceRelease)) {
+                g_print("Bad debounce times %s, expected press,release Milliseconds up to %d\n", argv[i], DEBOUNCE_MAX_TIME);
+                exit(1);
+            }
+        } else if (g_strcmp0(argv[i], "--no-repeat") == 0) {
+            isRepeatEnabled = FALSE;
+        } else if (g_strcmp0(argv[i], "--layouts") == 0 && i + 1 < argc) {
+            layoutPath = g_strdup(argv[++i]);
+        } else if (g_strcmp0(argv[i], "--keypad") == 0 && i + 1 < argc) {
+            if (specCount == MATRIX_MAX) {
+                g_print("At most %d keypads are supported\n", MATRIX_MAX);
+                exit(1);
+            }
+            keypadCpus[specCount] = -1;
+            if (!parseKeypad(argv[++i], &keypadPins[specCount], &keypadCpus[specCount])) {
+                g_print("Bad keypad description %s\n", argv[i]);
+                exit(1);
+            }
+            // Every pin belongs to one keypad, and the backlight has its own
+            pinMask = gpioPinMask(&keypadPins[specCount]);
+            if (pinMask == 0 || (pinMask & usedPins)) {
+                g_print("Keypad %s uses a pin twice, or one of another keypad or the backlight\n", argv[i]);
+                exit(1);
+            }
+            usedPins |= pinMask;
+            specCount++;
+        }
+    }
+    
+    // Benchmarks need neither hardware, X nor GTK, unless --bench-output
+    // measures the chosen output backend, against $DISPLAY for xlib and xcb
+    if (benchKeystrokes > 0) {
+        gpio = &simulatedBackend;
+        if (!benchOutput) {
+            output = &countingOutput;
+        }
+        if (flushEachKey) {
+            flushEachTarget = output;
+            flushEachOutput = *output;
+            flushEachOutput.sendKey = flushEachSendKey;
+            flushEachOutput.sendKeyAfter = NULL;
+            output = &flushEachOutput;
+        }
+        addKeypad(&ti83Pins);
+        setup();
+        runBenchmark(benchKeystrokes);
+        return 0;
+    }
+    
+    if (replayPath != NULL) {
+        gpio = &simulatedBackend;
+        output = &countingOutput;
+        addKeypad(&ti83Pins);
+        setup();
+        runReplay(replayPath, realtime);
+        return 0;
+    }
+    
+#ifndef HEADLESS
     gtk_init (&argc, &argv);
+#endif
 
-    if (geteuid() != 0) {
+    if (gpio == &wiringPiBackend && geteuid() != 0) {
         fprintf (stderr, "You need to be root to run this program. (sudo?)\n");
         exit(0);
     }
     
-    tray = gtk_status_icon_new_from_file(getImagePath(getModeIconImage()));
-    gtk_status_icon_set_tooltip_text(tray, "Normal");
+    if (specCount == 0) {
+        addKeypad(&ti83Pins);
+    }
+    for (i = 0; i < specCount; i++) {
+        addKeypad(&keypadPins[i]);
+    }
+    
+#ifndef HEADLESS
+    loadIcons();
+    tray = (modeIcons[MODE_NORMAL] != NULL) ? gtk_status_icon_new_from_pixbuf(modeIcons[MODE_NORMAL]) : gtk_status_icon_new();
+    gtk_status_icon_set_tooltip_text(tray, notifyModeNames[MODE_NORMAL]);
+#endif
     
     setup();
-    gint func_ref = g_timeout_add (SCAN_DELAY, loop, FALSE);
+    
+    if (statsOpen(keypadCount) == -1) {
+        g_print("Statistics unavailable, continuing without them\n");
+    }
+    
+    if ((eventFd = eventfd(0, EFD_NONBLOCK)) == -1) {
+        g_print("eventfd Initialization Failure\n");
+        exit(3);
+    }
+    loopWatch(eventFd, drainEvents, NULL);
+    
+    if (display != NULL) {
+        loopWatch(ConnectionNumber(display), handleXEvents, NULL);
+    }
+    if (isRepeatEnabled && repeatInit() == 0) {
+        loopWatch(repeatFd(), handleRepeat, NULL);
+    }
+    loopWatch(backlightFd(), handleBacklight, NULL);
+    if (macroInit() == 0) {
+        loopWatch(macroFd(), handleMacros, NULL);
+    }
+    
+    if (layoutPath != NULL) {
+        watchLayouts();
+    }
+    
+    if (eventRingOpen() == -1) {
+        g_print("Key event ring unavailable, continuing without it\n");
+    }
+    snprintf(hello, sizeof(hello), "events %s %d %d\n", EVENT_RING_NAME, EVENT_RING_VERSION, EVENT_RING_SIZE);
+    notifySetHello(hello);
+    notifySetCommands(handleCommand);
+    if ((modeSocket = notifyListen(NOTIFY_SOCKET, MODE_NORMAL)) != -1) {
+        loopWatch(modeSocket, handleModeClient, NULL);
+    } else {
+        g_print("Mode notifications unavailable, another driver may be running\n");
+    }
+    if (modeFd != -1) {
+        notifyAddFd(modeFd);
+    }
+    
+    // Stop cleanly on SIGINT and SIGTERM
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if ((signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) != -1) {
+        loopWatch(signalFd, handleSignal, NULL);
+    }
+    
+    if (recordPath != NULL) {
+        if (scannerRecord(&keypads[0].scanner, recordPath) == -1) {
+            g_print("Can't record to %s\n", recordPath);
+            exit(5);
+        }
+        loopWatch(traceWriterFd(&keypads[0].scanner.recorder), handleTrace, &keypads[0].scanner.recorder);
+    }
+    
+    // Lock everything in memory before the scanner threads start, so no scan waits on a page fault
+    if (realtimePriority > 0 && mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        g_print("Can't lock memory, scans may page fault\n");
+    }
+    // Each keypad scans on its own core: the one its spec names, or the next one up from --rt-cpu
+    for (i = 0; i < keypadCount; i++) {
+        cpu = (i < specCount && keypadCpus[i] >= 0) ? keypadCpus[i] : (realtimeCpu >= 0 ? realtimeCpu + i : -1);
+        scannerSetRealtime(&keypads[i].scanner, realtimePriority, cpu);
+        if (scannerStart(&keypads[i].scanner, &keypads[i].matrix, &keypads[i].queue, eventFd) != 0) {
+            g_print("Scanner Thread Initialization Failure\n");
+            exit(4);
+        }
+        if ((realtimePriority > 0 || cpu >= 0) && !scannerIsRealtime(&keypads[i].scanner)) {
+            g_print("Real-time scanning unavailable for keypad %d, scanning at normal priority\n", i);
+        }
+    }
+    
+    if (stressThreads > 0) {
+        startStress(stressThreads);
+    }
 
-    gtk_main();
+    notifySystemd("READY=1");
+    loopRun();
+    notifySystemd("STOPPING=1");
+    
+    // Leave no macro key or modifier held on the output
+    cancelMacros();
+    modifiersReleaseAll();
+    recordInjected(NULL, 0);
     
-    g_source_remove (func_ref);
+    for (i = 0; i < keypadCount; i++) {
+        scannerStop(&keypads[i].scanner);
+    }
+    if (recordPath != NULL && keypads[0].scanner.recorder.dropped > 0) {
+        g_print("The trace left out %u changes while the main loop was behind\n", keypads[0].scanner.recorder.dropped);
+    }
+    statsClose();
+    eventRingClose();
     
     return 0;
 }
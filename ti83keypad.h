@@ -1,6 +1,9 @@
 /***************************************************
  Filename: ti83keypad.h
  
+ Built with -DHEADLESS, the driver leaves out GTK
+ and the tray icon and runs as a daemon on its own
+ epoll loop; ti83tray shows the mode instead.
  ***************************************************/
 
 #ifndef ti83keypad_h
@@ -9,97 +12,82 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
 #include <wiringPi.h>
-#include <softPwm.h>
-#include <sr595.h>
+#ifdef HEADLESS
+#include <glib.h>
+#else
 #include <gtk/gtk.h>
+#endif
 #include <X11/Xlib.h>
 #include <X11/Intrinsic.h>
 #include <X11/keysymdef.h>
 #include <X11/extensions/XTest.h>
+#include "gpio.h"
+#include "output.h"
+#include "keyqueue.h"
+#include "scanner.h"
+#include "stats.h"
+#include "simtrace.h"
+#include "tracefile.h"
+#include "layoutfile.h"
+#include "repeat.h"
+#include "macro.h"
+#include "modifiers.h"
+#include "backlight.h"
+#include "eventloop.h"
+#include "notify.h"
+#include "eventring.h"
+#include "modes.h"
+
+_Static_assert(NOTIFY_MODES == MODE_COUNT, "Mode names and icons need an entry for every mode");
+_Static_assert(LAYOUT_MODES == MODE_COUNT - 1, "Layout images need a layout for every mode");
 
-// WiringPi Pins, not GPIOs
-#define CLOCK_PIN   25
-#define DATA_PIN    27
-#define LATCH_PIN   26
-#define ONKEY_PIN   9
-#define BACKLIGHT_PIN   1
-
-// Event Types
-#define EVENT_PRESS 1
-#define EVENT_RELEASE 2
-
-// Delays
-#define SCAN_DELAY      5 // In Milliseconds
-#define BOUNCE_DELAY    250 // In MilliSeconds
-
-// Mode corresponds to the keyboard layout used as well as the icon displayed
-#define MODE_NORMAL 1       // numbers.png
-#define MODE_ALPHA_LOWER 2  // lowercase.png
-#define MODE_ALPHA_UPPER 3  // uppercase.png
-#define MODE_SECOND 4       // 2nd.png
-#define MODE_TI83 5         // ti83mode.png
-
-// None of the defined KeySymbols are in the 0x8000 range
-#define SPECIAL_ALPHA_UPPER_KEY       0x8000
-#define SPECIAL_ALPHA_LOWER_KEY       0x8001
-#define SPECIAL_2ND_KEY               0x8002
-#define SPECIAL_LOCK_KEY              0x8003
-#define SPECIAL_NORMAL_KEY            0x8004
-#define SPECIAL_BRIGHT_UP_KEY         0x8005
-#define SPECIAL_BRIGHT_DOWN_KEY       0x8006
-#define SPECIAL_CONTROL_LOCK          0x8007
-
-#define SHIFT_SYMBOL_SIZE 39
 #define MAX_BRIGHTNESS   10
-
-GtkStatusIcon *tray;
+#define IDLE_DIM_LEVEL   150 // Of BACKLIGHT_MAX
+#define SHUTDOWN_FADE    1000 // Milliseconds
+#define REALTIME_PRIORITY   80 // SCHED_FIFO priority of the scanner thread with --rt
+#define CHORD_COUNT         (sizeof(chords) / sizeof(chords[0]))
+#define INJECT_BATCH_SIZE   64 // Most events flushed together
+
+#ifndef HEADLESS
+GtkStatusIcon *tray = NULL;
+GdkPixbuf *modeIcons[MODE_COUNT];
+guint iconUpdateSource = 0; // Pending applyStatusIcon, or 0
+const char *imageDirectory = NULL;
+#endif
 Display *display;
 
-// Key Symbols requiring a Shift (Add as needed)
-KeySym shiftSymbols[SHIFT_SYMBOL_SIZE] = {
-    XK_asciitilde,
-    XK_asciicircum,
-    XK_greater,
-    XK_dollar,
-    XK_percent,
-    XK_quotedbl,
-    XK_colon,
-    XK_question,
-    XK_ampersand,
-    XK_braceleft,
-    XK_braceright,
-    XK_underscore,
-    XK_bar,
-    XK_A,
-    XK_B,
-    XK_C,
-    XK_D,
-    XK_E,
-    XK_F,
-    XK_G,
-    XK_H,
-    XK_I,
-    XK_J,
-    XK_K,
-    XK_L,
-    XK_M,
-    XK_N,
-    XK_O,
-    XK_P,
-    XK_Q,
-    XK_R,
-    XK_S,
-    XK_T,
-    XK_U,
-    XK_V,
-    XK_W,
-    XK_X,
-    XK_Y,
-    XK_Z
-};
-
-int colPins[] = {7, 15, 16, 2, 3, 4, 21}; // Columns I, J, K, L, M, N, O
+// A layout entry resolved against the X keymap, so key events need no Xlib lookups
+typedef struct {
+    KeyCode keycode;            // 0 when there is nothing to send
+    unsigned char modifiers;    // ShiftMask when the symbol is on the shifted level
+    unsigned short special;     // SPECIAL_* action, 0 for ordinary keys
+    unsigned char modeAction;   // ACTION_*, its column in modeTransitions
+} KeyAction;
+
+// One keypad: its matrix and scanner thread, and the mode state of whoever is typing on it
+typedef struct {
+    int index;
+    GpioMatrix matrix;
+    Scanner scanner;
+    KeyQueue queue;
+    int mode;
+    int lastMode;
+    gboolean isAlphaLockActive;
+    gboolean isControlLockActive;
+    KeyAction pressedActions[ROW_COUNT + 1][COL_COUNT]; // What each held key was pressed as, including ON
+    int pressedModes[ROW_COUNT + 1][COL_COUNT]; // And the mode it was pressed in
+} Keypad;
+
+#define KEYPAD_KEY(keypad, row, col) (((keypad)->index * (ROW_COUNT + 1) + (row)) * COL_COUNT + (col)) // Repeat key id
 
 KeySym normalLayout[8][7] = {
     {XK_F11, XK_grave, XK_exclam, XK_at, XK_numbersign, XK_Escape, NoSymbol},  // Row A: Mode, Math, Apps, Prgm, Vars, Clear
@@ -156,37 +144,112 @@ KeySym ti83Layout[8][7] = {
     {XK_F5, NoSymbol, XK_0, XK_period, XK_asciitilde, XK_KP_Enter, XK_Down}       // Row H: Graph, Null, 0, ., (-), Enter, Down
 };
 
-int mode = MODE_NORMAL;
-int lastMode = MODE_NORMAL;
-gboolean isAlphaLockActive = FALSE;
-gboolean isControlLockActive = FALSE;
-gboolean isKeyPressed = FALSE;
-int colCount = 0;
+// The layouts above, by mode
+KeySym (*builtinLayouts[MODE_COUNT])[COL_COUNT] = {
+    [MODE_NORMAL] = normalLayout,
+    [MODE_ALPHA_LOWER] = alphaLowerLayout,
+    [MODE_ALPHA_UPPER] = alphaUpperLayout,
+    [MODE_SECOND] = secondLayout,
+    [MODE_TI83] = ti83Layout
+};
+
+// Autorepeat per mode: delay, interval, fastest interval (ms), acceleration (%)
+RepeatSetting modeRepeat[MODE_COUNT] = {
+    [MODE_NORMAL]       = {500, 100, 33, 90},
+    [MODE_ALPHA_LOWER]  = {500, 100, 33, 90},
+    [MODE_ALPHA_UPPER]  = {500, 100, 33, 90},
+    [MODE_SECOND]       = {500, 100, 33, 90},
+    [MODE_TI83]         = {500, 100, 33, 90}
+};
+
+// Per-key overrides, used in every mode when delay is set
+RepeatSetting keyRepeat[ROW_COUNT][COL_COUNT] = {
+    [1][0] = {400, 60, 25, 90},     // Del
+    [4][6] = {300, 60, 16, 85},     // Up
+    [5][6] = {300, 60, 16, 85},     // Right
+    [6][6] = {300, 60, 16, 85},     // Left
+    [7][6] = {300, 60, 16, 85}      // Down
+};
+
+gboolean isRepeatEnabled = TRUE;
+
+// Key chords; each fires when exactly its keys are held
+Chord chords[] = {
+    { .keys = { [0] = 1 << 0, [ONKEY_ROW] = 1 }, .action = CHORD_MODE_CYCLE },    // Mode + ON
+    { .keys = { [ONKEY_ROW] = 1 }, .hold = 3000, .action = CHORD_POWER_DOWN,     // 2nd, then hold ON
+      .modes = MODE_BIT(MODE_SECOND) }
+};
+
+Keypad keypads[MATRIX_MAX];
+int keypadCount = 0;
 int brightness = MAX_BRIGHTNESS;
+int idleDim = 60;   // Seconds without a key before dimming, 0 to never
+int idleOff = 600;  // Seconds before turning the backlight off, 0 to never
+int debouncePress = DEBOUNCE_PRESS_TIME;     // Milliseconds, for every keypad
+int debounceRelease = DEBOUNCE_RELEASE_TIME;
 GString * executable;
-
-gboolean isShiftRequired(KeySym keySym);
-int getColCount(void);
-void setValue(int outputValue);
-void setBit(int bit);
-gchar * getImagePath(char * imageFile);
-gchar * getModeIconImage(void);
-gboolean specialKey(KeySym keySym, int eventType);
+const GpioBackend *gpio = &wiringPiBackend;
+const OutputBackend *output = &xlibOutput;
+int eventFd = -1; // Shared by every scanner thread
+KeyAction keyTable[MODE_COUNT][ROW_COUNT + 1][COL_COUNT]; // Indexed by mode, row, col
+KeyCode shiftKeycode;
+const LayoutImage *layoutImage = NULL; // Replaces the built-in layouts when loaded
+gchar *layoutPath = NULL;
+int layoutWatchFd = -1;
+KeyCode controlKeycode;
+const OutputBackend *flushEachTarget = NULL; // The output --flush-each wraps
+OutputBackend flushEachOutput;
+
+gboolean isSpecialSymbol(KeySym keySym);
+KeyAction resolveKeySymbol(KeySym keySym);
+void buildKeyTable(void);
+void handleXEvents(int fd, void *data);
+gboolean loadLayouts(const char *path);
+void watchLayouts(void);
+void handleLayoutChange(int fd, void *data);
+#ifndef HEADLESS
+gchar * getImageDirectory(void);
+void loadIcons(void);
+gboolean applyStatusIcon(gpointer data);
+void destroy(GtkWidget *widget, gpointer data);
+#endif
 void brightnessUp(void);
 void brightnessDown(void);
-void changeAlphaLock(void);
-void changeControlLock(void);
-void handleLockStatus(KeySym keySym);
+void applyModeStep(Keypad *keypad, ModeStep step);
 void updateStatusIcon(void);
-void changeMode(int newMode);
-void cycleModes(void);
-void destroy(GtkWidget *widget, gpointer data);
+void changeMode(Keypad *keypad, int newMode);
+void cycleModes(Keypad *keypad);
 void setup(void);
 void powerDown(void);
-void emulateKeyPress(KeySym keySym);
-void emulateKeyRelease(KeySym keySym);
-KeySym getKeySymbol(int row, int col);
-gboolean loop(gpointer data);
+void emulateKeyPress(Keypad *keypad, const KeyAction *action);
+void emulateKeyRelease(Keypad *keypad, const KeyAction *action);
+KeySym getKeySymbol(int layoutMode, int row, int col);
+void publishEvent(Keypad *keypad, const KeyEvent *event, int keyMode);
+void handleKeyEvent(Keypad *keypad, const KeyEvent *event);
+void handleBacklight(int fd, void *data);
+void handleTrace(int fd, void *data);
+void handleRepeat(int fd, void *data);
+void playMacro(int number);
+void sendMacroKey(KeyCode keycode, Bool isPress, unsigned long delay, int canDelay);
+void handleMacros(int fd, void *data);
+void cancelMacros(void);
+void recordInjected(const KeyEvent *events, int count);
+void drainEvents(int fd, void *data);
+void handleModeClient(int fd, void *data);
+void handleCommand(int fd, const char *command);
+void handleSignal(int fd, void *data);
+void discardPrint(const gchar *message);
+void benchmarkPass(int keystrokes, int tier);
+void flushEachSendKey(KeyCode keycode, Bool isPress);
+void runBenchmark(int keystrokes);
+uint64_t replayScan(Keypad *keypad, const uint8_t *rows, uint64_t now, uint64_t startTime);
+void runReplay(const char *path, gboolean realtime);
+gboolean parseNumber(const char *text, long min, long max, int *value);
+gboolean parseKeypad(const char *spec, MatrixPins *pins, int *cpu);
+gboolean parseDebounce(const char *spec, int *pressMillis, int *releaseMillis);
+void addKeypad(const MatrixPins *pins);
+void *burnCpu(void *data);
+void startStress(int threads);
 int main(int argc, char *argv[]);
 
 #endif /* ti83keypad_h */
@@ -0,0 +1,265 @@
+/***************************************************
+  Filename: ti83layout.c
+
+  Compiles a text layout file (see layouts.conf) into
+  the binary image the driver loads with --layouts.
+  Macros may be used before the [macros] section
+  that defines them.
+
+***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+#include "layoutfile.h"
+
+#define MACRO_SECTION LAYOUT_MODES // Section number of [macros]
+
+static int lineNumber = 0;
+static char *macroNames[LAYOUT_MACROS];
+static int macroDefined[LAYOUT_MACROS];
+
+static void fail(const char *message, const char *detail)
+{
+    fprintf(stderr, "line %d: %s%s\n", lineNumber, message, detail);
+    exit(1);
+}
+
+// Splits off the next token, or returns NULL at the end of the line or a
+// comment. Strings keep their opening quote so they can be told apart;
+// inside them a backslash escapes the next character.
+static char *nextToken(char **cursor)
+{
+    char *p = *cursor;
+    char *token, *out;
+
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (*p == '\0' || *p == '#') {
+        *cursor = p;
+        return NULL;
+    }
+
+    token = p;
+    if (*p == '"') {
+        out = ++p;
+        while (*p != '"') {
+            if (*p == '\0' || *p == '\n') {
+                fail("unterminated string", "");
+            }
+            if (*p == '\\' && p[1] != '\0' && p[1] != '\n') {
+                p++;
+            }
+            *out++ = *p++;
+        }
+        *out = '\0';
+        *cursor = p + 1;
+        return token;
+    }
+
+    while (*p != '\0' && *p != '#' && !isspace((unsigned char) *p)) {
+        p++;
+    }
+    if (*p == '#') {
+        *p = '\0';
+        *cursor = p;
+    } else if (*p != '\0') {
+        *p = '\0';
+        *cursor = p + 1;
+    } else {
+        *cursor = p;
+    }
+    return token;
+}
+
+// Macros are numbered in order of first mention
+static int macroNumber(const char *name)
+{
+    int i;
+
+    for (i = 0; i < LAYOUT_MACROS && macroNames[i] != NULL; i++) {
+        if (strcmp(name, macroNames[i]) == 0) {
+            return i;
+        }
+    }
+    if (i == LAYOUT_MACROS) {
+        fail("too many macros at ", name);
+    }
+    macroNames[i] = strdup(name);
+    return i;
+}
+
+static uint32_t parseSymbol(const char *token)
+{
+    KeySym keySym;
+    int i;
+
+    if (strcmp(token, "none") == 0) {
+        return NoSymbol;
+    }
+    if (token[0] == '@') {
+        return SPECIAL_MACRO_KEY + macroNumber(token + 1);
+    }
+    for (i = 0; layoutSpecialNames[i] != NULL; i++) {
+        if (strcmp(token, layoutSpecialNames[i]) == 0) {
+            return SPECIAL_ALPHA_UPPER_KEY + i;
+        }
+    }
+    if ((keySym = XStringToKeysym(token)) == NoSymbol) {
+        fail("unknown keysym ", token);
+    }
+    return keySym;
+}
+
+// A macro line is its name and then steps: keysyms, "strings" typed a
+// character at a time, and +milliseconds pauses
+static void parseMacro(LayoutImage *image, char *name, char **cursor)
+{
+    uint32_t *steps;
+    uint32_t symbol;
+    char *token, *end, *c;
+    unsigned long pause;
+    int number = macroNumber(name);
+    int count = 0;
+
+    if (macroDefined[number]) {
+        fail("macro defined twice: ", name);
+    }
+    macroDefined[number] = 1;
+    steps = image->macros[number];
+
+    while ((token = nextToken(cursor)) != NULL) {
+        if (token[0] == '"') {
+            for (c = token + 1; *c != '\0'; c++) {
+                // Printable ASCII keysyms are the characters themselves
+                if (*c < 0x20 || *c > 0x7e) {
+                    fail("only printable ASCII in strings: ", token + 1);
+                }
+                if (count == LAYOUT_STEPS) {
+                    fail("too many steps in ", name);
+                }
+                steps[count++] = (unsigned char) *c;
+            }
+            continue;
+        }
+        if (count == LAYOUT_STEPS) {
+            fail("too many steps in ", name);
+        }
+        if (token[0] == '+') {
+            pause = strtoul(token + 1, &end, 10);
+            if (*end != '\0' || end == token + 1 || pause > 0xffff) {
+                fail("bad pause ", token);
+            }
+            steps[count++] = LAYOUT_PAUSE | pause;
+            continue;
+        }
+        symbol = parseSymbol(token);
+        if (symbol == NoSymbol || (symbol >= SPECIAL_ALPHA_UPPER_KEY && symbol < SPECIAL_MACRO_KEY + LAYOUT_MACROS)) {
+            fail("macros can only type keys: ", token);
+        }
+        steps[count++] = symbol;
+    }
+
+    if (count == 0) {
+        fail("empty macro ", name);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static LayoutImage image;
+    int rowsSeen[LAYOUT_MODES] = {0};
+    char line[1024];
+    char *token, *cursor, *end;
+    int mode = -1;
+    int i, col;
+    FILE *in, *out;
+    char tmpPath[4096];
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s layouts.conf layouts.bin\n", argv[0]);
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        lineNumber++;
+        cursor = line;
+        if ((token = nextToken(&cursor)) == NULL) {
+            continue;
+        }
+
+        if (token[0] == '[') {
+            if ((end = strchr(token, ']')) == NULL) {
+                fail("unterminated section ", token);
+            }
+            *end = '\0';
+            if (strcmp(token + 1, "macros") == 0) {
+                mode = MACRO_SECTION;
+                continue;
+            }
+            for (mode = 0; mode < LAYOUT_MODES && strcmp(token + 1, layoutModeNames[mode]) != 0; mode++);
+            if (mode == LAYOUT_MODES) {
+                fail("unknown mode ", token + 1);
+            }
+            continue;
+        }
+
+        if (mode == -1) {
+            fail("keys before the first [mode] section", "");
+        }
+        if (mode == MACRO_SECTION) {
+            parseMacro(&image, token, &cursor);
+            continue;
+        }
+        if (rowsSeen[mode] == ROW_COUNT) {
+            fail("too many rows in ", layoutModeNames[mode]);
+        }
+        for (col = 0; col < COL_COUNT; col++, token = nextToken(&cursor)) {
+            if (token == NULL) {
+                fail("too few columns", "");
+            }
+            image.symbols[mode][rowsSeen[mode]][col] = parseSymbol(token);
+        }
+        if (nextToken(&cursor) != NULL) {
+            fail("too many columns", "");
+        }
+        rowsSeen[mode]++;
+    }
+    fclose(in);
+
+    lineNumber = 0;
+    for (i = 0; i < LAYOUT_MODES; i++) {
+        if (rowsSeen[i] != ROW_COUNT) {
+            fail("missing rows in ", layoutModeNames[i]);
+        }
+    }
+    for (i = 0; i < LAYOUT_MACROS && macroNames[i] != NULL; i++) {
+        if (!macroDefined[i]) {
+            fail("undefined macro ", macroNames[i]);
+        }
+    }
+
+    memcpy(image.magic, LAYOUT_MAGIC, 8);
+    image.modes = LAYOUT_MODES;
+    image.rows = ROW_COUNT;
+    image.cols = COL_COUNT;
+
+    // Write beside the target and rename, so a running driver never sees half an image
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", argv[2]);
+    if ((out = fopen(tmpPath, "wb")) == NULL ||
+        fwrite(&image, sizeof(image), 1, out) != 1 || fclose(out) != 0 ||
+        rename(tmpPath, argv[2]) != 0) {
+        perror(argv[2]);
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+/***************************************************
+  Filename: ti83stats.c
+
+  Dumps the live statistics of a running ti83keypad
+  without disturbing it.
+
+***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "keyqueue.h"
+#include "stats.h"
+
+static void printHistogram(const char *name, const Histogram *histogram)
+{
+    printf("%-18s n=%-8lu p50=%-6lu p90=%-6lu p99=%-6lu max=%lu us\n", name,
+           atomic_load(&histogram->samples),
+           (unsigned long) histogramPercentile(histogram, 0.50),
+           (unsigned long) histogramPercentile(histogram, 0.90),
+           (unsigned long) histogramPercentile(histogram, 0.99),
+           atomic_load(&histogram->max));
+}
+
+static void printKeypad(int index, const KeypadStats *keypad, const Stats *live, unsigned long scansBefore)
+{
+    int i;
+
+    printf("Keypad %d\n", index);
+    printf("Scans/sec          %lu\n", atomic_load(&keypad->scans) - scansBefore);
+    printf("Scans              %lu\n", atomic_load(&keypad->scans));
+    if (atomic_load(&keypad->scanPeriod) == 0) {
+        printf("Scan period        idle, waiting for a key\n");
+    } else {
+        printf("Scan period        %lu us\n", atomic_load(&keypad->scanPeriod));
+    }
+    printf("Rate changes       %lu\n", atomic_load(&keypad->rateChanges));
+    for (i = 0; i < STATS_TIERS && atomic_load(&live->tierPeriods[i]); i++) {
+        printf("  at %6lu us      %lu scans\n", atomic_load(&live->tierPeriods[i]), atomic_load(&keypad->tierScans[i]));
+    }
+    printf("Missed deadlines   %lu\n", atomic_load(&keypad->missedDeadlines));
+    printf("Events queued      %lu\n", atomic_load(&keypad->eventsQueued));
+    printf("Events dropped     %lu\n", atomic_load(&keypad->eventsDropped));
+    printHistogram("Scan duration", &keypad->scanDuration);
+    printHistogram("Scan jitter", &keypad->scanJitter);
+    printHistogram("Detect->accept", &keypad->detectToAccept);
+
+    // A press can land just after a sample, so it waits a whole period plus
+    // the worst wake-up before debouncing even starts
+    printf("Worst detection    %lu us (fastest period + worst jitter + worst debounce)\n",
+           atomic_load(&live->tierPeriods[0]) + atomic_load(&keypad->scanJitter.max) +
+           atomic_load(&keypad->detectToAccept.max));
+}
+
+int main(int argc, char *argv[])
+{
+    int fd;
+    Stats *live;
+    unsigned long scansBefore[STATS_KEYPADS];
+    double uptime;
+    int i;
+
+    if ((fd = shm_open(STATS_NAME, O_RDONLY, 0)) == -1) {
+        if (errno == EACCES) {
+            fprintf(stderr, "Only root and the %s group may read the statistics\n", STATS_GROUP);
+        } else {
+            fprintf(stderr, "ti83keypad doesn't appear to be running\n");
+        }
+        exit(1);
+    }
+    live = mmap(NULL, sizeof(Stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (live == MAP_FAILED || live->magic != STATS_MAGIC || live->version != STATS_VERSION ||
+        live->keypadCount > STATS_KEYPADS) {
+        fprintf(stderr, "Unrecognized statistics page\n");
+        exit(1);
+    }
+
+    // Sample the scan counters over a second for the current rates
+    for (i = 0; i < live->keypadCount; i++) {
+        scansBefore[i] = atomic_load(&live->keypads[i].scans);
+    }
+    sleep(1);
+
+    uptime = (monotonicNanos() - live->startTime) / 1e9;
+    printf("Uptime             %.1f s\n", uptime);
+    printf("Events injected    %lu\n", atomic_load(&live->eventsInjected));
+    printf("Flushes            %lu\n", atomic_load(&live->flushes));
+    printHistogram("Accept->inject", &live->acceptToInject);
+    printHistogram("Detect->inject", &live->detectToInject);
+    for (i = 0; i < live->keypadCount; i++) {
+        printf("\n");
+        printKeypad(i, &live->keypads[i], live, scansBefore[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/***************************************************
+  Filename: ti83tray.c
+
+  Optional tray icon for the headless ti83keypadd.
+  Shows the current keypad mode, following the
+  driver's mode notifications.
+
+***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gtk/gtk.h>
+#include "notify.h"
+
+#define RECONNECT_DELAY 2000 // ms between attempts while the driver is down
+
+static GtkStatusIcon *tray;
+static GdkPixbuf *modeIcons[NOTIFY_MODES];
+static GString *pending;
+
+static gboolean connectDriver(gpointer data);
+
+static void loadIcons(const char *argv0, const char *imageDirectory)
+{
+    gchar *exe = g_file_read_link("/proc/self/exe", NULL);
+    gchar *folder = g_path_get_dirname((exe != NULL) ? exe : argv0);
+    gchar *images = (imageDirectory != NULL) ? g_strdup(imageDirectory) : g_build_filename(folder, "images", NULL);
+    gchar *path;
+    GError *error = NULL;
+    int mode;
+
+    for (mode = 1; mode < NOTIFY_MODES; mode++) {
+        path = g_build_filename(images, notifyModeIcons[mode], NULL);
+        if ((modeIcons[mode] = gdk_pixbuf_new_from_file(path, &error)) == NULL) {
+            g_print("Can't load icon %s: %s\n", path, error->message);
+            g_clear_error(&error);
+        }
+        g_free(path);
+    }
+    g_free(exe);
+    g_free(folder);
+    g_free(images);
+}
+
+static void showMode(int mode)
+{
+    if (mode <= 0 || mode >= NOTIFY_MODES) {
+        return;
+    }
+    if (modeIcons[mode] != NULL) {
+        gtk_status_icon_set_from_pixbuf(tray, modeIcons[mode]);
+    }
+    gtk_status_icon_set_tooltip_text(tray, notifyModeNames[mode]);
+}
+
+static void showDisconnected(void)
+{
+    gtk_status_icon_set_tooltip_text(tray, "Keypad driver not running");
+}
+
+// Lines may arrive split across reads, so only complete ones are parsed
+static gboolean handleDriver(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    int fd = g_io_channel_unix_get_fd(source);
+    char buffer[256];
+    char *line;
+    char *end;
+    ssize_t length;
+    int mode;
+
+    length = read(fd, buffer, sizeof(buffer));
+    if (length <= 0) {
+        close(fd);
+        g_io_channel_unref(source);
+        g_string_truncate(pending, 0);
+        showDisconnected();
+        g_timeout_add(RECONNECT_DELAY, connectDriver, NULL);
+        return FALSE;
+    }
+
+    g_string_append_len(pending, buffer, length);
+    line = pending->str;
+    while ((end = strchr(line, '\n')) != NULL) {
+        *end = '\0';
+        if (sscanf(line, "mode %d", &mode) == 1) {
+            showMode(mode);
+        }
+        line = end + 1;
+    }
+    g_string_erase(pending, 0, line - pending->str);
+    return TRUE;
+}
+
+static gboolean connectDriver(gpointer data)
+{
+    int fd = notifyConnect(NOTIFY_SOCKET);
+
+    if (fd == -1) {
+        return TRUE; // Keep retrying
+    }
+    g_io_add_watch(g_io_channel_unix_new(fd), G_IO_IN | G_IO_HUP | G_IO_ERR, handleDriver, NULL);
+    return FALSE;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *imageDirectory = NULL;
+    int i;
+
+    gtk_init(&argc, &argv);
+
+    for (i = 1; i < argc; i++) {
+        if (g_strcmp0(argv[i], "--images") == 0 && i + 1 < argc) {
+            imageDirectory = argv[++i];
+        }
+    }
+
+    loadIcons(argv[0], imageDirectory);
+    pending = g_string_new("");
+    tray = gtk_status_icon_new();
+    showDisconnected();
+
+    if (connectDriver(NULL)) {
+        g_timeout_add(RECONNECT_DELAY, connectDriver, NULL);
+    }
+
+    gtk_main();
+    return 0;
+}
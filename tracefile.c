@@ -0,0 +1,274 @@
+/***************************************************
+ Filename: tracefile.c
+
+***************************************************/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include "scanner.h"
+#include "tracefile.h"
+
+#define TRACE_HEADER_SIZE   24 // Magic, version, scan period, start time
+#define TRACE_RECORD_MAX    (5 + 10 + 2 + TRACE_ROWS)
+
+static int putVarint(uint8_t *out, uint64_t value)
+{
+    int length = 0;
+
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+static int getVarint(TraceReader *reader, uint64_t *value)
+{
+    int shift = 0;
+    uint8_t byte;
+
+    *value = 0;
+    do {
+        if (reader->offset >= reader->size || shift > 63) {
+            return 0;
+        }
+        byte = reader->data[reader->offset++];
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return 1;
+}
+
+static void putLittleEndian(uint8_t *out, uint64_t value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++) {
+        out[i] = value >> (8 * i);
+    }
+}
+
+static uint64_t getLittleEndian(const uint8_t *in, int bytes)
+{
+    int i;
+    uint64_t value = 0;
+
+    for (i = 0; i < bytes; i++) {
+        value |= (uint64_t) in[i] << (8 * i);
+    }
+    return value;
+}
+
+// Writes out the buffers the scanner has handed over
+static void writeBuffers(TraceWriter *writer)
+{
+    unsigned int filled = atomic_load_explicit(&writer->filled, memory_order_acquire);
+    unsigned int written = atomic_load_explicit(&writer->written, memory_order_relaxed);
+    int index;
+
+    while (written != filled) {
+        index = written % TRACE_BUFFERS;
+        if (write(writer->fd, writer->buffers[index], writer->used[index]) != writer->used[index]) {
+            // Out of space; the trace just ends early
+        }
+        atomic_store_explicit(&writer->written, ++written, memory_order_release);
+    }
+}
+
+// Hands the filling buffer to the main loop and starts the next one.
+// Returns -1, keeping the buffer, if every other one is still waiting.
+static int handOver(TraceWriter *writer)
+{
+    unsigned int filled = atomic_load_explicit(&writer->filled, memory_order_relaxed);
+    uint64_t one = 1;
+
+    if (filled - atomic_load_explicit(&writer->written, memory_order_acquire) >= TRACE_BUFFERS - 1) {
+        return -1;
+    }
+    atomic_store_explicit(&writer->filled, filled + 1, memory_order_release);
+    writer->used[(filled + 1) % TRACE_BUFFERS] = 0;
+    if (write(writer->wakeFd, &one, sizeof(one)) != sizeof(one)) {
+        // Only fails on overflow, and the main loop is already due to drain
+    }
+    return 0;
+}
+
+int traceWriterOpen(TraceWriter *writer, const char *path, uint64_t startTime)
+{
+    uint8_t *header = writer->buffers[0];
+
+    memset(writer, 0, sizeof(*writer));
+    if ((writer->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        return -1;
+    }
+    if ((writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        close(writer->wakeFd);
+        return -1;
+    }
+
+    memcpy(header, TRACE_MAGIC, 8);
+    putLittleEndian(header + 8, TRACE_VERSION, 4);
+    putLittleEndian(header + 12, scanTiers[0], 4);
+    putLittleEndian(header + 16, startTime, 8);
+    writer->used[0] = TRACE_HEADER_SIZE;
+    writer->lastTime = startTime;
+
+    return 0;
+}
+
+// Runs on the scanner thread, so it never touches the file
+void traceWriterScan(TraceWriter *writer, uint64_t now, const uint8_t *snapshot)
+{
+    int index = atomic_load_explicit(&writer->filled, memory_order_relaxed) % TRACE_BUFFERS;
+    uint8_t *record;
+    uint16_t changed = 0;
+    uint64_t elapsed;
+    int row;
+
+    writer->scans++;
+    for (row = 0; row < TRACE_ROWS; row++) {
+        if (snapshot[row] != writer->last[row]) {
+            changed |= 1 << row;
+        }
+    }
+    if (changed == 0) {
+        return;
+    }
+
+    if (writer->used[index] + TRACE_RECORD_MAX > TRACE_BUFFER_SIZE) {
+        if (handOver(writer) == -1) {
+            // Nothing is recorded, so the next record still holds against last
+            writer->dropped++;
+            return;
+        }
+        index = (index + 1) % TRACE_BUFFERS;
+    }
+
+    // Whole microseconds since the time the reader will have reached, not since
+    // the last scan, so the reader's clock never falls behind by more than one
+    elapsed = (now - writer->lastTime) / 1000;
+    record = writer->buffers[index] + writer->used[index];
+    record += putVarint(record, writer->scans);
+    record += putVarint(record, elapsed);
+    putLittleEndian(record, changed, 2);
+    record += 2;
+    for (row = 0; row < TRACE_ROWS; row++) {
+        if (changed & (1 << row)) {
+            *record++ = snapshot[row];
+            writer->last[row] = snapshot[row];
+        }
+    }
+
+    writer->used[index] = record - writer->buffers[index];
+    writer->lastTime += elapsed * 1000;
+    writer->scans = 0;
+}
+
+int traceWriterFd(const TraceWriter *writer)
+{
+    return writer->wakeFd;
+}
+
+// Called on the main loop when traceWriterFd() becomes readable
+void traceWriterDrain(TraceWriter *writer)
+{
+    uint64_t count;
+
+    if (read(writer->wakeFd, &count, sizeof(count)) == sizeof(count)) {
+        writeBuffers(writer);
+    }
+}
+
+// Once the scanner has stopped: writes what waits, then the buffer it was filling
+void traceWriterClose(TraceWriter *writer)
+{
+    int index;
+
+    if (writer->fd != -1) {
+        writeBuffers(writer);
+        index = atomic_load(&writer->filled) % TRACE_BUFFERS;
+        if (write(writer->fd, writer->buffers[index], writer->used[index]) != writer->used[index]) {
+            // Out of space
+        }
+        close(writer->fd);
+        close(writer->wakeFd);
+        writer->fd = -1;
+    }
+}
+
+int traceReaderOpen(TraceReader *reader, const char *path)
+{
+    struct stat info;
+    void *map;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return -1;
+    }
+    if (fstat(fd, &info) == -1 || info.st_size < TRACE_HEADER_SIZE) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    reader->data = map;
+    reader->size = info.st_size;
+    if (memcmp(reader->data, TRACE_MAGIC, 8) != 0 || getLittleEndian(reader->data + 8, 4) != TRACE_VERSION) {
+        traceReaderClose(reader);
+        return -1;
+    }
+
+    reader->scanPeriod = getLittleEndian(reader->data + 12, 4);
+    reader->startTime = getLittleEndian(reader->data + 16, 8);
+    reader->time = reader->startTime;
+    reader->offset = TRACE_HEADER_SIZE;
+    return 0;
+}
+
+// Advance to the next change. scans receives how many scans it took to get
+// there; reader->time and reader->rows hold the new sample. Returns 0 at the end.
+int traceReaderNext(TraceReader *reader, uint32_t *scans)
+{
+    uint64_t scanCount, elapsed;
+    uint16_t changed;
+    int row;
+
+    if (!getVarint(reader, &scanCount) || !getVarint(reader, &elapsed) ||
+        reader->offset + 2 > reader->size) {
+        return 0;
+    }
+    changed = getLittleEndian(reader->data + reader->offset, 2);
+    reader->offset += 2;
+
+    for (row = 0; row < TRACE_ROWS; row++) {
+        if (changed & (1 << row)) {
+            if (reader->offset >= reader->size) {
+                return 0;
+            }
+            reader->rows[row] = reader->data[reader->offset++];
+        }
+    }
+
+    *scans = scanCount;
+    reader->time += elapsed * 1000;
+    return 1;
+}
+
+void traceReaderClose(TraceReader *reader)
+{
+    if (reader->data) {
+        munmap((void *) reader->data, reader->size);
+        reader->data = NULL;
+    }
+}
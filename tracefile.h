@@ -0,0 +1,61 @@
+/***************************************************
+ Filename: tracefile.h
+
+ Raw scan traces. The recorder appends a record only
+ when the sampled matrix changes: the number of scans
+ and microseconds since the previous record, a mask
+ of the rows that changed, and their new bytes.
+ Records are buffered on the scanner thread; a full
+ buffer is handed over to the main loop, which does
+ the writing. With every buffer waiting, a change is
+ left out and the next record covers it instead.
+ ***************************************************/
+
+#ifndef tracefile_h
+#define tracefile_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "gpio.h"
+
+#define TRACE_MAGIC         "T83TRACE"
+#define TRACE_VERSION       1
+#define TRACE_ROWS          (ROW_COUNT + 1) // Includes the ON key row
+#define TRACE_BUFFER_SIZE   4096
+#define TRACE_BUFFERS       4 // The one filling and those waiting for the main loop
+
+typedef struct {
+    int fd;
+    int wakeFd; // eventfd, readable while full buffers wait
+    uint8_t buffers[TRACE_BUFFERS][TRACE_BUFFER_SIZE];
+    int used[TRACE_BUFFERS];
+    atomic_uint filled;  // Buffers handed over, by the scanner; the next one is filling
+    atomic_uint written; // Buffers written out, by the main loop
+    uint8_t last[TRACE_ROWS];
+    uint64_t lastTime; // As the reader will rebuild it, so rounding doesn't add up
+    uint32_t scans;    // Since the last record
+    uint32_t dropped;  // Changes left out while every buffer waited
+} TraceWriter;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    uint32_t scanPeriod; // Fastest scan period when recorded, in microseconds
+    uint64_t startTime;  // CLOCK_MONOTONIC, in nanoseconds
+    uint64_t time;
+    uint8_t rows[TRACE_ROWS];
+} TraceReader;
+
+int traceWriterOpen(TraceWriter *writer, const char *path, uint64_t startTime);
+void traceWriterScan(TraceWriter *writer, uint64_t now, const uint8_t *snapshot);
+int traceWriterFd(const TraceWriter *writer);
+void traceWriterDrain(TraceWriter *writer);
+void traceWriterClose(TraceWriter *writer);
+
+int traceReaderOpen(TraceReader *reader, const char *path);
+int traceReaderNext(TraceReader *reader, uint32_t *scans);
+void traceReaderClose(TraceReader *reader);
+
+#endif /* tracefile_h */